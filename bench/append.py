@@ -0,0 +1,13 @@
+#!/usr/bin/env python3
+# Prints a Lox program that builds one string out of COUNT appended fragments (default 100000).
+# Lox has no loops yet, so the appends are unrolled into one statement each.
+import sys
+
+count = int(sys.argv[1]) if len(sys.argv) > 1 else 100000
+
+print('var fragment = "fragment";')
+print('var s = "";')
+for _ in range(count):
+    print('s = s + fragment;')
+# comparing forces the rope to be flattened once
+print('print s == fragment;')
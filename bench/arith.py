@@ -0,0 +1,16 @@
+#!/usr/bin/env python3
+# Prints a Lox program of COUNT random arithmetic assignments between 26 global variables (default 100000).
+# Lox has no loops yet, so the work is unrolled into one statement each.
+import random
+import sys
+
+count = int(sys.argv[1]) if len(sys.argv) > 1 else 100000
+random.seed(1)
+
+names = [chr(ord('a') + i) for i in range(26)]
+for i, name in enumerate(names):
+    print('var %s = %d;' % (name, i + 1))
+for _ in range(count):
+    a, b, c, d = (random.choice(names) for _ in range(4))
+    print('%s = %s + %s * %s - %s / 3;' % (a, b, c, d, a))
+print('print a + b;')
@@ -0,0 +1,21 @@
+#!/usr/bin/env python3
+# Prints a Lox program of COUNT rounds of comparisons and boolean tests between global variables (default 100000).
+import random
+import sys
+
+count = int(sys.argv[1]) if len(sys.argv) > 1 else 100000
+random.seed(1)
+
+names = ['x%d' % i for i in range(16)]
+for i, name in enumerate(names):
+    print('var %s = %d;' % (name, i * 7 % 16))
+print('var hits = 0;')
+print('var flag = false;')
+for _ in range(count):
+    a, b = random.sample(names, 2)
+    op = random.choice(['<', '<=', '>', '>=', '==', '!='])
+    print('flag = %s %s %s;' % (a, op, b))
+    print('flag = !flag == (%s - %s > %d);' % (a, b, random.randrange(-8, 8)))
+    print('%s = -%s + %d;' % (a, b, random.randrange(16)))
+print('print flag;')
+print('print x0 + x1;')
@@ -0,0 +1,15 @@
+#!/usr/bin/env python3
+# Prints a large Lox program, COUNT groups of three lines with long expressions over distinct literals (default 50000),
+# that takes much longer to scan, compile and optimize than to run.
+import sys
+
+count = int(sys.argv[1]) if len(sys.argv) > 1 else 50000
+
+print('var total = 0;')
+for i in range(count):
+    v = 'v%d' % (i % 64)
+    terms = ' + '.join('%d.%d * %s' % (i, j, v) for j in range(8))
+    print('var %s = %d;' % (v, i))
+    print('total = total + %s * %d - %d / 2;' % (v, i, i))
+    print('var b%d = (%s) > %d == ("s%d" == "s%d");' % (i % 64, terms, i, i % 5, i % 7))
+print('print total;')
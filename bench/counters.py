@@ -0,0 +1,17 @@
+#!/usr/bin/env python3
+# Prints a Lox program that steps COUNT counters and accumulators the way an unrolled loop body would (default 100000).
+import sys
+
+count = int(sys.argv[1]) if len(sys.argv) > 1 else 100000
+
+print('var i = 0;')
+print('var total = 0;')
+print('var step = 3;')
+print('var last = 0;')
+for _ in range(count):
+    print('i = i + 1;')
+    print('total = total + i * step;')
+    print('last = total - last;')
+print('print i;')
+print('print total;')
+print('print last;')
@@ -0,0 +1,15 @@
+#!/usr/bin/env python3
+# Prints a Lox program of COUNT random reads and writes spread over 200 global variables (default 100000).
+import random
+import sys
+
+count = int(sys.argv[1]) if len(sys.argv) > 1 else 100000
+random.seed(1)
+
+names = ['g%d' % i for i in range(200)]
+for i, name in enumerate(names):
+    print('var %s = %d;' % (name, i))
+for _ in range(count):
+    a, b, c = (random.choice(names) for _ in range(3))
+    print('%s = %s - %s;' % (a, b, c))
+print('print g0;')
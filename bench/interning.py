@@ -0,0 +1,13 @@
+#!/usr/bin/env python3
+# Prints a Lox program that builds COUNT short strings at run time (default 100000). Each of them is below the rope
+# threshold, so every concatenation hashes its result and looks it up in the intern table, and about half of them
+# are new strings.
+import sys
+
+count = int(sys.argv[1]) if len(sys.argv) > 1 else 100000
+
+print('var key = "key";')
+for i in range(count):
+    print('var k%d = "%d";' % (i % 1000, i // 2))
+    print('key = "key" + k%d;' % (i % 1000))
+print('print key;')
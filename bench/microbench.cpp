@@ -0,0 +1,306 @@
+// Times the interpreter's components in isolation: the scanner, the compiler, the tables, string interning, the
+// allocator and the dispatch loop. `make microbench` builds this against the objects of an optimized build and runs it.
+//
+// Every benchmark repeats its body until it has run for at least --time seconds and reports the fastest of --rounds
+// such measurements, as items per second and nanoseconds per item. Names containing one of the arguments are run,
+// all of them if there is none.
+//
+// usage: microbench [--time SECONDS] [--rounds N] [NAME...]
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "chunk.h"
+#include "compiler.h"
+#include "memory.h"
+#include "object.h"
+#include "scanner.h"
+#include "table.h"
+#include "vm.h"
+
+static double minimumTime = 0.2;
+static int rounds = 3;
+static std::vector<std::string_view> filters;
+
+// keeps the compiler from dropping a result that is never used
+static volatile size_t sink;
+
+static bool selected(std::string_view name)
+{
+    if (filters.empty()) { return true; }
+    return std::any_of(filters.begin(), filters.end(), [name](std::string_view filter) { return name.find(filter) != std::string_view::npos; });
+}
+
+// body runs the benchmark once and returns the number of items (tokens, bytes, operations) it processed
+static void measure(std::string_view name, const char *unit, const std::function<size_t()> &body)
+{
+    if (!selected(name)) { return; }
+
+    double best = 0;
+    for (int round = 0; round != rounds; ++round) {
+        size_t items = 0;
+        double elapsed = 0;
+        auto start = std::chrono::steady_clock::now();
+        while (elapsed < minimumTime) {
+            items += body();
+            elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+        best = std::max(best, items / elapsed);
+    }
+    printf("%-30s %14.0f %-9s %10.2f ns\n", name.data(), best, unit, 1e9 / best);
+}
+
+// a program of count groups of statements like those of bench/compile.py
+static std::string makeSource(int count)
+{
+    std::string source = "var total = 0;\n";
+    char line[512];
+    for (int i = 0; i != count; ++i) {
+        int v = i % 64;
+        snprintf(line, sizeof line, "var v%d = %d;\ntotal = total + v%d * %d - %d / 2;\n", v, i, v, i, i);
+        source += line;
+        snprintf(line, sizeof line, "var b%d = (%d.5 * v%d + \"s%d\" == \"s%d\") > %d != !false;\n", v, i, v, i % 5, i % 7, i);
+        source += line;
+    }
+    source += "print total;\n";
+    return source;
+}
+
+// the same statements indented, commented and with long names and strings, as hand-written code would have
+static std::string makeCommentedSource(int count)
+{
+    std::string source = "var total = 0;\n";
+    char line[1024];
+    for (int i = 0; i != count; ++i) {
+        int v = i % 64;
+        snprintf(line, sizeof line,
+                 "        // group %d: update the running total from the value of this group, then compare two strings\n"
+                 "        var running_value_%d = %d;\n"
+                 "        total = total + running_value_%d * %d - %d / 2;  // halved so that the total stays small\n"
+                 "        var comparison_%d = \"the first string of group %d\" == \"the second string of the group\";\n",
+                 i, v, i, v, i, i, v, i % 5);
+        source += line;
+    }
+    source += "print total;\n";
+    return source;
+}
+
+// distinct keys, kept alive as the constants of roots while it is in scope
+static std::vector<ObjString *> makeKeys(VM &vm, Chunk &roots, size_t count, const char *prefix)
+{
+    std::vector<ObjString *> keys;
+    char chars[64];
+    for (size_t i = 0; i != count; ++i) {
+        int length = snprintf(chars, sizeof chars, "%s%zu", prefix, i);
+        keys.push_back(copyString(vm, chars, length));
+        roots.addConstant(OBJ_VAL(keys.back()));
+    }
+    return keys;
+}
+
+static void benchScanner(const std::string &name, const std::string &source)
+{
+    measure(name + ".scanToken", "tokens/s", [&source] {
+        Scanner scanner(source);
+        size_t tokens = 1;
+        while (scanner.scanToken().type != TOKEN_EOF) { ++tokens; }
+        return tokens;
+    });
+    measure(name + ".bytes", "bytes/s", [&source] {
+        Scanner scanner(source);
+        while (scanner.scanToken().type != TOKEN_EOF) {}
+        return source.size();
+    });
+}
+
+static void benchCompiler(VM &vm, const std::string &source)
+{
+    for (int level = 0; level <= 2; ++level) {
+        std::string name = "compiler.compile -O" + std::to_string(level);
+        measure(name, "bytes/s", [&vm, &source, level] {
+            InterpretOptions options;
+            options.optimizationLevel = level;
+            vm.setOptions(options);
+            Chunk chunk;
+            if (!vm.compile(source, chunk)) { exit(1); }
+            return source.size();
+        });
+    }
+    vm.setOptions(InterpretOptions());
+}
+
+static void benchTables(VM &vm)
+{
+    for (size_t size : {16, 1024, 65536}) {
+        Chunk roots;
+        VM::ChunkScope scope(vm, &roots);
+        std::vector<ObjString *> keys = makeKeys(vm, roots, size, "key");
+        std::vector<ObjString *> missing = makeKeys(vm, roots, size, "missing");
+        std::string suffix = "/" + std::to_string(size);
+
+        measure("table.set" + suffix, "ops/s", [&keys] {
+            Table table;
+            for (size_t i = 0; i != keys.size(); ++i) { table.set(keys[i], NUMBER_VAL(static_cast<double>(i))); }
+            return keys.size();
+        });
+
+        Table table;
+        for (size_t i = 0; i != keys.size(); ++i) { table.set(keys[i], NUMBER_VAL(static_cast<double>(i))); }
+        measure("table.get hit" + suffix, "ops/s", [&table, &keys] {
+            Value value;
+            size_t found = 0;
+            for (ObjString *key : keys) { found += table.get(key, &value); }
+            sink = found;
+            return keys.size();
+        });
+        measure("table.get miss" + suffix, "ops/s", [&table, &missing] {
+            Value value;
+            size_t found = 0;
+            for (ObjString *key : missing) { found += table.get(key, &value); }
+            sink = found;
+            return missing.size();
+        });
+
+        StringTable strings;
+        for (ObjString *key : keys) { strings.add(key); }
+        measure("strings.findString hit" + suffix, "ops/s", [&strings, &keys] {
+            size_t found = 0;
+            for (ObjString *key : keys) { found += strings.findString(key->getChars(), key->getLength(), key->getHash()) != nullptr; }
+            sink = found;
+            return keys.size();
+        });
+        measure("strings.findString miss" + suffix, "ops/s", [&strings, &missing] {
+            size_t found = 0;
+            for (ObjString *key : missing) { found += strings.findString(key->getChars(), key->getLength(), key->getHash()) != nullptr; }
+            sink = found;
+            return missing.size();
+        });
+    }
+}
+
+static void benchStrings(VM &vm)
+{
+    constexpr size_t COUNT = 4096;
+    Chunk roots;
+    VM::ChunkScope scope(vm, &roots);
+    std::vector<ObjString *> interned = makeKeys(vm, roots, COUNT, "interned");
+    std::vector<std::string> copies;
+    for (ObjString *string : interned) { copies.emplace_back(string->getChars(), string->getLength()); }
+
+    measure("copyString interned", "ops/s", [&vm, &copies] {
+        for (const std::string &chars : copies) { sink = reinterpret_cast<size_t>(copyString(vm, chars.data(), static_cast<int>(chars.size()))); }
+        return copies.size();
+    });
+    // each string is new, so this also allocates it and, now and then, collects the earlier ones
+    size_t serial = 0;
+    measure("copyString new", "ops/s", [&vm, &serial] {
+        char chars[32];
+        for (size_t i = 0; i != COUNT; ++i) {
+            int length = snprintf(chars, sizeof chars, "fresh%zu", serial++);
+            sink = reinterpret_cast<size_t>(copyString(vm, chars, length));
+        }
+        return COUNT;
+    });
+}
+
+static void benchAllocator(VM &vm)
+{
+    // sizes drawn like those of small objects, with a few large blocks, freed in a shuffled order
+    constexpr size_t COUNT = 4096;
+    std::mt19937 random(42);
+    std::vector<size_t> sizes(COUNT);
+    for (size_t &size : sizes) { size = random() % 16 == 0 ? 256 + random() % 4096 : 16 + random() % 112; }
+    std::vector<size_t> order(COUNT);
+    for (size_t i = 0; i != COUNT; ++i) { order[i] = i; }
+    std::shuffle(order.begin(), order.end(), random);
+    std::vector<void *> blocks(COUNT);
+
+    measure("reallocate", "ops/s", [&] {
+        for (size_t i = 0; i != COUNT; ++i) { blocks[i] = reallocate(vm, nullptr, 0, sizes[i]); }
+        for (size_t i : order) { reallocate(vm, blocks[i], sizes[i], 0); }
+        return 2 * COUNT;
+    });
+    measure("reallocate grow", "ops/s", [&] {
+        void *block = nullptr;
+        size_t size = 0;
+        for (size_t i = 0; i != COUNT; ++i) {
+            block = reallocate(vm, block, size, size + 8);
+            size += 8;
+        }
+        reallocate(vm, block, size, 0);
+        return COUNT + 1;
+    });
+
+    Allocator allocator;
+    measure("Allocator", "ops/s", [&] {
+        for (size_t i = 0; i != COUNT; ++i) { blocks[i] = allocator.allocate(sizes[i]); }
+        for (size_t i : order) { allocator.deallocate(blocks[i], sizes[i]); }
+        return 2 * COUNT;
+    });
+    measure("malloc", "ops/s", [&] {
+        for (size_t i = 0; i != COUNT; ++i) { blocks[i] = malloc(sizes[i]); }
+        for (size_t i : order) { free(blocks[i]); }
+        return 2 * COUNT;
+    });
+}
+
+// the same compiled chunk executed over and over, which is as close as the language comes to a loop: instructions are
+// only quickened on their first execution, so this is where quickening shows
+static void benchExecution(VM &vm)
+{
+    constexpr int COUNT = 1000;
+    std::string source = "var a = 1;\nvar b = 2;\nvar c = 3;\nvar d = false;\n";
+    for (int i = 0; i != COUNT; ++i) { source += "a = a + b;\nb = b + c * 0.5;\nd = a == b;\nc = c - a / 7 + 1;\n"; }
+
+    for (bool quicken : {true, false}) {
+        InterpretOptions options;
+        options.quicken = quicken;
+        vm.setOptions(options);
+        Chunk chunk;
+        if (!vm.compile(source, chunk)) { exit(1); }
+        measure(quicken ? "vm.execute numeric" : "vm.execute numeric --no-quicken", "stmts/s", [&vm, &chunk] {
+            if (vm.execute(chunk) != INTERPRET_OK) { exit(1); }
+            return 4 * COUNT + 4;
+        });
+    }
+    vm.setOptions(InterpretOptions());
+}
+
+static void usage()
+{
+    fprintf(stderr, "Usage: microbench [--time SECONDS] [--rounds N] [NAME...]\n");
+    exit(64);
+}
+
+int main(int argc, const char *argv[])
+{
+    for (int i = 1; i != argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg == "--time" && i + 1 != argc) {
+            minimumTime = atof(argv[++i]);
+        } else if (arg == "--rounds" && i + 1 != argc) {
+            rounds = std::max(1, atoi(argv[++i]));
+        } else if (arg.starts_with("-")) {
+            usage();
+        } else {
+            filters.push_back(arg);
+        }
+    }
+
+    std::string source = makeSource(20000);
+    benchScanner("scanner", source);
+    benchScanner("scanner commented", makeCommentedSource(20000));
+    VM vm;
+    benchCompiler(vm, source);
+    benchTables(vm);
+    benchStrings(vm);
+    benchAllocator(vm);
+    benchExecution(vm);
+    return 0;
+}
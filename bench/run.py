@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+# Runs the benchmark corpus against a cxxlox binary; `make bench` builds an optimized one and calls this.
+#
+# Every program is generated into WORKDIR and run RUNS times with --no-cache, so that each run compiles from source. The
+# report has the median wall time of the runs, the peak RSS of the largest run and the number of instructions executed,
+# which is taken from one extra run under --profile-opcodes. It is printed as a table and written to WORKDIR/bench.json;
+# pass the JSON of an earlier run as --baseline to see the change against it. Each --arg is passed on to cxxlox, so that
+# `--arg=--register-vm --baseline JSON` compares the register machine with a run of the stack machine.
+#
+# usage: run.py CXXLOX WORKDIR [--runs N] [--baseline JSON] [--arg ARG]... [NAME...]
+import argparse
+import json
+import os
+import re
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+here = os.path.dirname(os.path.abspath(__file__))
+
+# name: (generator, argument, what the program stresses)
+CORPUS = {
+    'globals': ('globals.py', 200000, 'global variable reads and writes'),
+    'arith': ('arith.py', 200000, 'arithmetic on globals'),
+    'counters': ('counters.py', 100000, 'unrolled loop bodies updating counters'),
+    'compare': ('compare.py', 100000, 'comparisons and boolean tests'),
+    'append': ('append.py', 100000, 'string concatenation into one long string'),
+    'interning': ('interning.py', 100000, 'short strings built and interned at run time'),
+    'compile': ('compile.py', 50000, 'scanning, compiling and optimizing a large source file'),
+}
+
+
+def run_once(command):
+    # stderr goes to a file rather than a pipe, which a child writing more than the pipe buffer would block on while
+    # wait4() waits for it
+    with tempfile.TemporaryFile() as errors:
+        start = time.perf_counter()
+        process = subprocess.Popen(command, stdout=subprocess.DEVNULL, stderr=errors)
+        # wait4() gives the resource usage of this child alone
+        _, status, usage = os.wait4(process.pid, 0)
+        elapsed = time.perf_counter() - start
+        errors.seek(0)
+        stderr = errors.read().decode()
+    return elapsed, usage.ru_maxrss, os.waitstatus_to_exitcode(status), stderr
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('cxxlox')
+    parser.add_argument('workdir')
+    parser.add_argument('--runs', type=int, default=5)
+    parser.add_argument('--baseline')
+    parser.add_argument('--arg', action='append', default=[])
+    parser.add_argument('names', nargs='*', default=list(CORPUS))
+    args = parser.parse_intermixed_args()
+
+    baseline = {}
+    if args.baseline:
+        with open(args.baseline) as file:
+            baseline = {result['name']: result for result in json.load(file)['benchmarks']}
+
+    os.makedirs(args.workdir, exist_ok=True)
+    results = []
+    print(('%-10s %10s %12s %10s %6s  %s' % ('benchmark', 'median s', 'instructions', 'peak KB', 'exit', 'vs baseline' if baseline else '')).rstrip())
+    for name in args.names:
+        generator, argument, description = CORPUS[name]
+        path = os.path.join(args.workdir, name + '.lox')
+        with open(path, 'w') as file:
+            subprocess.run([sys.executable, os.path.join(here, generator), str(argument)], stdout=file, check=True)
+
+        command = [args.cxxlox, '--no-cache'] + args.arg + [path]
+        runs = [run_once(command) for _ in range(args.runs)]
+        _, _, _, profile = run_once([args.cxxlox, '--no-cache', '--profile-opcodes'] + args.arg + [path])
+        match = re.search(r'^profile: (\d+) instructions', profile, re.MULTILINE)
+
+        result = {
+            'name': name,
+            'description': description,
+            'median_seconds': statistics.median(run[0] for run in runs),
+            'seconds': [run[0] for run in runs],
+            'instructions': int(match.group(1)) if match else None,
+            'peak_rss_kb': max(run[1] for run in runs),
+            'exit_code': runs[0][2],
+        }
+        results.append(result)
+
+        change = ''
+        if name in baseline:
+            change = '%+.1f%%' % (100 * (result['median_seconds'] / baseline[name]['median_seconds'] - 1))
+        print(('%-10s %10.4f %12s %10d %6d  %s' % (name, result['median_seconds'], result['instructions'], result['peak_rss_kb'], result['exit_code'], change)).rstrip())
+
+    revision = subprocess.run(['git', '-C', here, 'rev-parse', '--short', 'HEAD'], capture_output=True, text=True).stdout.strip()
+    output = os.path.join(args.workdir, 'bench.json')
+    with open(output, 'w') as file:
+        json.dump({'revision': revision, 'binary': args.cxxlox, 'args': args.arg, 'runs': args.runs, 'benchmarks': results}, file, indent=2)
+        file.write('\n')
+    print('results written to %s' % output)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+# Chooses superinstructions from the opcode sequences of the benchmark corpus.
+#
+# Every corpus program is generated and compiled at -O1, and its code is read back from --dump-bytecode. Candidates are
+# then picked greedily: the pair or triple of plain opcodes that would save the largest share of dispatches is chosen,
+# the code is fused with all the candidates chosen so far the way the optimizer does it, the sequences left are counted
+# again, and so on. The candidates are printed in the order SUPERINSTRUCTIONS has to try them in. Shares are per program, averaged over the corpus, so
+# that each program weighs the same. Like the optimizer, fusion never crosses a line. Lox has no loops yet, so the
+# static counts are also the dynamic ones.
+#
+# usage: superinstructions.py [path-to-cxxlox] [count] [rounds]
+import collections
+import os
+import subprocess
+import sys
+import tempfile
+
+here = os.path.dirname(os.path.abspath(__file__))
+cxxlox = sys.argv[1] if len(sys.argv) > 1 else os.path.join(here, '..', 'build', 'cxxlox')
+count = sys.argv[2] if len(sys.argv) > 2 else '20000'
+rounds = int(sys.argv[3]) if len(sys.argv) > 3 else 8
+corpus = ['append', 'arith', 'compare', 'counters']
+
+
+# the opcodes of each source line of the program, in order
+def compile_lines(name):
+    source = subprocess.run([sys.executable, os.path.join(here, name + '.py'), count], check=True, capture_output=True, text=True).stdout
+    with tempfile.NamedTemporaryFile('w', suffix='.lox') as script:
+        script.write(source)
+        script.flush()
+        dump = subprocess.run([cxxlox, '--no-cache', '-O1', '--dump-bytecode', '--compile-only', script.name], capture_output=True,
+                              text=True).stdout
+    lines = []
+    for line in dump.splitlines()[1:]:
+        fields = line.split()
+        if fields[1] != '|':
+            lines.append([])
+        lines[-1].append(fields[2])
+    return lines
+
+
+# like Optimizer::encodeSuperinstruction(): at each instruction, the first candidate that matches there wins
+def fuse(line, chosen):
+    fused = []
+    i = 0
+    while i < len(line):
+        for sequence in chosen:
+            if tuple(line[i:i + len(sequence)]) == sequence:
+                fused.append('+'.join(sequence))
+                i += len(sequence)
+                break
+        else:
+            fused.append(line[i])
+            i += 1
+    return fused
+
+
+programs = {name: compile_lines(name) for name in corpus}
+chosen = []
+for _ in range(rounds):
+    saved = collections.Counter()
+    for lines in programs.values():
+        total = sum(len(line) for line in lines)
+        for line in lines:
+            line = fuse(line, chosen)
+            for length in (2, 3):
+                for i in range(len(line) - length + 1):
+                    sequence = tuple(line[i:i + length])
+                    if all('+' not in op for op in sequence):
+                        saved[sequence] += (length - 1) / total / len(corpus)
+    if not saved:
+        break
+    best, share = saved.most_common(1)[0]
+    print('%6.2f%%  %s' % (100 * share, ' '.join(best)))
+    chosen.append(best)
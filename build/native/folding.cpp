@@ -0,0 +1,219 @@
+// translated by cxxlox --emit-cpp; build it against the runtime with `make native`
+#include "native.h"
+
+namespace {
+
+const NativeConstant constants0[] = {
+    {NativeConstant::STRING, 0, "concatenated", 12},
+    {NativeConstant::STRING, 0, "x", 1},
+    {NativeConstant::STRING, 0, "ab", 2},
+    {NativeConstant::STRING, 0, "c", 1},
+    {NativeConstant::STRING, 0, "d", 1},
+    {NativeConstant::STRING, 0, "", 0},
+    {NativeConstant::NUMBER, 0x4014000000000000, nullptr, 0},
+    {NativeConstant::NUMBER, 0xc018000000000000, nullptr, 0},
+    {NativeConstant::NUMBER, 0xfff8000000000000, nullptr, 0},
+    {NativeConstant::NUMBER, 0x3ff0000000000000, nullptr, 0},
+    {NativeConstant::STRING, 0, "unused", 6},
+    {NativeConstant::STRING, 0, "both", 4},
+};
+
+[[gnu::noinline]] bool chunk0_0(NativeRuntime &runtime, Value *stack)
+{
+    [[maybe_unused]] Value *globals = runtime.globals();
+    [[maybe_unused]] const Value *constants = runtime.constants(0);
+    // line 4
+    stack[0] = constants[0];
+    runtime.print(stack + 1);
+    // line 5
+    stack[0] = constants[1];
+    globals[0] = stack[0];
+    // line 6
+    stack[0] = constants[2];
+    stack[1] = globals[0];
+    if (IS_UNDEFINED(stack[1])) { return runtime.undefinedVariable(0, 6); }
+    if (IS_NUMBER(stack[0]) && IS_NUMBER(stack[1])) {
+        stack[0] = NUMBER_VAL(AS_NUMBER(stack[0]) + AS_NUMBER(stack[1]));
+    } else if (!runtime.add(stack + 2, 6)) {
+        return false;
+    }
+    runtime.print(stack + 1);
+    // line 7
+    stack[0] = globals[0];
+    if (IS_UNDEFINED(stack[0])) { return runtime.undefinedVariable(0, 7); }
+    stack[1] = constants[3];
+    if (IS_NUMBER(stack[0]) && IS_NUMBER(stack[1])) {
+        stack[0] = NUMBER_VAL(AS_NUMBER(stack[0]) + AS_NUMBER(stack[1]));
+    } else if (!runtime.add(stack + 2, 7)) {
+        return false;
+    }
+    stack[1] = constants[4];
+    if (IS_NUMBER(stack[0]) && IS_NUMBER(stack[1])) {
+        stack[0] = NUMBER_VAL(AS_NUMBER(stack[0]) + AS_NUMBER(stack[1]));
+    } else if (!runtime.add(stack + 2, 7)) {
+        return false;
+    }
+    runtime.print(stack + 1);
+    // line 8
+    stack[0] = constants[5];
+    runtime.print(stack + 1);
+    // line 11
+    stack[0] = NUMBER_VAL(0x1.4p+2);
+    runtime.print(stack + 1);
+    // line 12
+    stack[0] = NUMBER_VAL(-0x1.8p+2);
+    runtime.print(stack + 1);
+    // line 13
+    stack[0] = BOOL_VAL(true);
+    runtime.print(stack + 1);
+    // line 14
+    stack[0] = BOOL_VAL(false);
+    runtime.print(stack + 1);
+    // line 15
+    stack[0] = BOOL_VAL(false);
+    runtime.print(stack + 1);
+    // line 19
+    stack[0] = NUMBER_VAL(std::bit_cast<double>(UINT64_C(0xfff8000000000000)));
+    globals[1] = stack[0];
+    // line 20
+    stack[0] = BOOL_VAL(false);
+    runtime.print(stack + 1);
+    // line 21
+    stack[0] = BOOL_VAL(false);
+    runtime.print(stack + 1);
+    // line 22
+    stack[0] = BOOL_VAL(false);
+    runtime.print(stack + 1);
+    // line 23
+    stack[0] = BOOL_VAL(true);
+    runtime.print(stack + 1);
+    // line 24
+    stack[0] = BOOL_VAL(false);
+    runtime.print(stack + 1);
+    // line 25
+    stack[0] = BOOL_VAL(true);
+    runtime.print(stack + 1);
+    // line 26
+    stack[0] = globals[1];
+    if (IS_UNDEFINED(stack[0])) { return runtime.undefinedVariable(1, 26); }
+    stack[1] = NUMBER_VAL(0x1p+0);
+    if (!IS_NUMBER(stack[0]) || !IS_NUMBER(stack[1])) { return runtime.error(26, "Operands must be numbers."); }
+    stack[0] = BOOL_VAL(AS_NUMBER(stack[0]) < AS_NUMBER(stack[1]));
+    runtime.print(stack + 1);
+    // line 27
+    stack[0] = globals[1];
+    if (IS_UNDEFINED(stack[0])) { return runtime.undefinedVariable(1, 27); }
+    stack[1] = NUMBER_VAL(0x1p+0);
+    if (!IS_NUMBER(stack[0]) || !IS_NUMBER(stack[1])) { return runtime.error(27, "Operands must be numbers."); }
+    stack[0] = BOOL_VAL(!(AS_NUMBER(stack[0]) < AS_NUMBER(stack[1])));
+    runtime.print(stack + 1);
+    // line 28
+    stack[0] = globals[1];
+    if (IS_UNDEFINED(stack[0])) { return runtime.undefinedVariable(1, 28); }
+    stack[1] = NUMBER_VAL(0x1p+0);
+    if (!IS_NUMBER(stack[0]) || !IS_NUMBER(stack[1])) { return runtime.error(28, "Operands must be numbers."); }
+    stack[0] = BOOL_VAL(!(AS_NUMBER(stack[0]) < AS_NUMBER(stack[1])));
+    runtime.print(stack + 1);
+    // line 29
+    stack[0] = globals[1];
+    if (IS_UNDEFINED(stack[0])) { return runtime.undefinedVariable(1, 29); }
+    stack[1] = NUMBER_VAL(0x1p+0);
+    if (!IS_NUMBER(stack[0]) || !IS_NUMBER(stack[1])) { return runtime.error(29, "Operands must be numbers."); }
+    stack[0] = BOOL_VAL(!(AS_NUMBER(stack[0]) > AS_NUMBER(stack[1])));
+    runtime.print(stack + 1);
+    // line 30
+    stack[0] = globals[1];
+    if (IS_UNDEFINED(stack[0])) { return runtime.undefinedVariable(1, 30); }
+    stack[1] = NUMBER_VAL(0x1p+0);
+    if (!IS_NUMBER(stack[0]) || !IS_NUMBER(stack[1])) { return runtime.error(30, "Operands must be numbers."); }
+    stack[0] = BOOL_VAL(!(AS_NUMBER(stack[0]) > AS_NUMBER(stack[1])));
+    runtime.print(stack + 1);
+    // line 31
+    stack[0] = globals[1];
+    if (IS_UNDEFINED(stack[0])) { return runtime.undefinedVariable(1, 31); }
+    stack[1] = globals[1];
+    if (IS_UNDEFINED(stack[1])) { return runtime.undefinedVariable(1, 31); }
+    stack[0] = BOOL_VAL(runtime.equal(stack + 2));
+    runtime.print(stack + 1);
+    // line 32
+    stack[0] = globals[1];
+    if (IS_UNDEFINED(stack[0])) { return runtime.undefinedVariable(1, 32); }
+    stack[1] = globals[1];
+    if (IS_UNDEFINED(stack[1])) { return runtime.undefinedVariable(1, 32); }
+    stack[0] = BOOL_VAL(runtime.equal(stack + 2));
+    runtime.print(stack + 1);
+    // line 35
+    stack[0] = BOOL_VAL(false);
+    runtime.print(stack + 1);
+    // line 36
+    stack[0] = BOOL_VAL(false);
+    runtime.print(stack + 1);
+    // line 37
+    stack[0] = BOOL_VAL(true);
+    runtime.print(stack + 1);
+    // line 38
+    stack[0] = BOOL_VAL(true);
+    runtime.print(stack + 1);
+    // line 44
+    stack[0] = globals[0];
+    if (IS_UNDEFINED(stack[0])) { return runtime.undefinedVariable(0, 44); }
+    stack[1] = constants[10];
+    if (IS_NUMBER(stack[0]) && IS_NUMBER(stack[1])) {
+        stack[0] = NUMBER_VAL(AS_NUMBER(stack[0]) + AS_NUMBER(stack[1]));
+    } else if (!runtime.add(stack + 2, 44)) {
+        return false;
+    }
+    // line 47
+    stack[0] = NUMBER_VAL(0x1p+0);
+    globals[2] = stack[0];
+    // line 48
+    stack[0] = globals[2];
+    if (IS_UNDEFINED(stack[0])) { return runtime.undefinedVariable(2, 48); }
+    stack[1] = NUMBER_VAL(0x1p+0);
+    if (IS_NUMBER(stack[0]) && IS_NUMBER(stack[1])) {
+        stack[0] = NUMBER_VAL(AS_NUMBER(stack[0]) + AS_NUMBER(stack[1]));
+    } else if (!runtime.add(stack + 2, 48)) {
+        return false;
+    }
+    if (IS_UNDEFINED(globals[2])) { return runtime.undefinedAssignment(2, 48); }
+    globals[2] = stack[0];
+    // line 49
+    runtime.print(stack + 1);
+    // line 50
+    stack[0] = constants[11];
+    if (IS_UNDEFINED(globals[0])) { return runtime.undefinedAssignment(0, 50); }
+    globals[0] = stack[0];
+    if (IS_UNDEFINED(globals[2])) { return runtime.undefinedAssignment(2, 50); }
+    globals[2] = stack[0];
+    // line 51
+    runtime.print(stack + 1);
+    // line 52
+    stack[0] = globals[0];
+    if (IS_UNDEFINED(stack[0])) { return runtime.undefinedVariable(0, 52); }
+    runtime.print(stack + 1);
+    // line 53
+    return true;
+}
+
+bool chunk0(NativeRuntime &runtime, Value *stack)
+{
+    if (!chunk0_0(runtime, stack)) { return false; }
+    return true;
+}
+
+const char *const globalNames[] = {
+    "s",
+    "nan",
+    "n",
+};
+
+const NativeChunk chunks[] = {
+    {nullptr, constants0, 12, chunk0},
+};
+
+}  // namespace
+
+int main()
+{
+    return NativeRuntime::main(NativeProgram{globalNames, 3, chunks, 1});
+}
@@ -0,0 +1,355 @@
+#include <algorithm>
+#include <bit>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "object.h"
+
+namespace {
+
+constexpr char MAGIC[4] = {'L', 'O', 'X', 'C'};
+
+enum ConstantTag : uint8_t
+{
+    TAG_CONSTANT_NIL,
+    TAG_CONSTANT_FALSE,
+    TAG_CONSTANT_TRUE,
+    TAG_CONSTANT_NUMBER,
+    TAG_CONSTANT_STRING,
+};
+
+struct Header
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t optimizationLevel;
+    uint32_t reserved;  // zero; fills what would be padding, so that identical compiles write identical files
+    uint64_t sourceHash;
+    uint64_t payloadHash;  // of everything after the header, so that a damaged file is never executed
+    uint32_t codeSize;
+    uint32_t lineRunCount;
+    uint32_t constantCount;
+    uint32_t globalCount;
+};
+
+// same scheme as the string hash in object.cpp, but keeping all 64 bits since a collision would run stale code
+uint64_t hashBytes(std::string_view bytes)
+{
+    constexpr uint64_t MULTIPLIER = 0x9e3779b97f4a7c15u;
+    const char *key = bytes.data();
+    size_t length = bytes.size();
+    uint64_t hash = 0xcbf29ce484222325u ^ length;
+    for (; length >= 8; key += 8, length -= 8) {
+        uint64_t word;
+        memcpy(&word, key, 8);
+        hash = (std::rotl(hash, 29) ^ word) * MULTIPLIER;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, key, length);
+    hash = (std::rotl(hash, 29) ^ tail) * MULTIPLIER;
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdu;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+// bounds-checked cursor over the mapped file; a truncated or corrupt file just fails to load
+class Reader
+{
+public:
+    Reader(const char *data, size_t size) : current(data), end(data + size) {}
+
+    bool read(void *out, size_t size)
+    {
+        if (static_cast<size_t>(end - current) < size) { return false; }
+        memcpy(out, current, size);
+        current += size;
+        return true;
+    }
+
+    const char *take(size_t size)
+    {
+        if (static_cast<size_t>(end - current) < size) { return nullptr; }
+        const char *result = current;
+        current += size;
+        return result;
+    }
+
+    bool atEnd() const { return current == end; }
+    size_t remaining() const { return static_cast<size_t>(end - current); }
+
+private:
+    const char *current;
+    const char *end;
+};
+
+class Writer
+{
+public:
+    template <typename T>
+    void write(const T &value)
+    {
+        write(&value, sizeof(value));
+    }
+
+    void write(const void *data, size_t size) { buffer.append(static_cast<const char *>(data), size); }
+
+    const std::string &data() const { return buffer; }
+
+private:
+    std::string buffer;
+};
+
+bool readString(Reader &reader, const char **chars, uint32_t *length)
+{
+    if (!reader.read(length, sizeof(*length))) { return false; }
+    *chars = reader.take(*length);
+    return *chars != nullptr;
+}
+
+void writeString(Writer &writer, const ObjString *string)
+{
+    writer.write(static_cast<uint32_t>(string->getLength()));
+    writer.write(string->getChars(), string->getLength());
+}
+
+// how many values an instruction other than a superinstruction takes off the stack and how many it puts back; false
+// for an opcode a stored chunk never has, which includes OP_IMPORT, since a script that imports is never stored
+bool stackEffect(OpCode op, size_t *pops, size_t *pushes)
+{
+    switch (genericForm(op)) {
+    case OP_CONSTANT:
+    case OP_CONSTANT_LONG:
+    case OP_FALSE:
+    case OP_GET_GLOBAL:
+    case OP_GET_GLOBAL_LONG:
+    case OP_NIL:
+    case OP_TRUE:
+        *pops = 0;
+        *pushes = 1;
+        return true;
+    case OP_ADD:
+    case OP_DIVIDE:
+    case OP_EQUAL:
+    case OP_GREATER:
+    case OP_GREATER_EQUAL:
+    case OP_LESS:
+    case OP_LESS_EQUAL:
+    case OP_MULTIPLY:
+    case OP_NOT_EQUAL:
+    case OP_SUBTRACT:
+        *pops = 2;
+        *pushes = 1;
+        return true;
+    case OP_DEFINE_GLOBAL:
+    case OP_DEFINE_GLOBAL_LONG:
+    case OP_POP:
+    case OP_PRINT:
+        *pops = 1;
+        *pushes = 0;
+        return true;
+    case OP_NEGATE:
+    case OP_NOT:
+    case OP_SET_GLOBAL:
+    case OP_SET_GLOBAL_LONG:
+        *pops = 1;
+        *pushes = 1;
+        return true;
+    case OP_RETURN:
+        *pops = 0;
+        *pushes = 0;
+        return true;
+    default:
+        return false;
+    }
+}
+
+}  // namespace
+
+bool BytecodeCache::parse(VM &vm, const char *data, size_t size, std::string_view source, Chunk &chunk)
+{
+    Reader reader(data, size);
+    Header header;
+    if (!reader.read(&header, sizeof(header))) { return false; }
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != CACHE_VERSION) { return false; }
+    if (header.optimizationLevel != static_cast<uint32_t>(vm.getOptions().optimizationLevel)) { return false; }
+    if (header.sourceHash != hashBytes(source)) { return false; }
+    if (header.payloadHash != hashBytes(std::string_view(data + sizeof(header), size - sizeof(header)))) { return false; }
+
+    const char *code = reader.take(header.codeSize);
+    if (code == nullptr) { return false; }
+    chunk.code.assign(code, code + header.codeSize);
+    if (header.lineRunCount > reader.remaining() / sizeof(LineRun)) { return false; }
+    chunk.lines.resize(header.lineRunCount);
+    if (!reader.read(chunk.lines.data(), header.lineRunCount * sizeof(chunk.lines[0]))) { return false; }
+    // getLine() relies on the runs covering the code from offset 0 in increasing order
+    if (header.codeSize != 0 && (chunk.lines.empty() || chunk.lines[0].offset != 0)) { return false; }
+    for (size_t i = 1; i < chunk.lines.size(); ++i) {
+        if (chunk.lines[i].offset <= chunk.lines[i - 1].offset || chunk.lines[i].offset >= header.codeSize) { return false; }
+    }
+
+    for (uint32_t i = 0; i != header.constantCount; ++i) {
+        ConstantTag tag;
+        if (!reader.read(&tag, sizeof(tag))) { return false; }
+        switch (tag) {
+        case TAG_CONSTANT_NIL:
+            chunk.addConstant(NIL_VAL);
+            break;
+        case TAG_CONSTANT_FALSE:
+            chunk.addConstant(BOOL_VAL(false));
+            break;
+        case TAG_CONSTANT_TRUE:
+            chunk.addConstant(BOOL_VAL(true));
+            break;
+        case TAG_CONSTANT_NUMBER: {
+            double number;
+            if (!reader.read(&number, sizeof(number))) { return false; }
+            chunk.addConstant(NUMBER_VAL(number));
+            break;
+        }
+        case TAG_CONSTANT_STRING: {
+            const char *chars;
+            uint32_t length;
+            if (!readString(reader, &chars, &length)) { return false; }
+            // added to the chunk right away, which the caller keeps rooted while further strings are allocated
+            chunk.addConstant(OBJ_VAL(copyString(vm, chars, length)));
+            break;
+        }
+        default:
+            return false;
+        }
+    }
+    // a stored pool is deduplicated already, so a duplicate would only shift the indices the code refers to
+    if (chunk.constants.count() != header.constantCount) { return false; }
+    if (!verify(chunk, header.globalCount)) { return false; }
+
+    // the code refers to globals by slot, so the slots have to come out the same as when the file was written; that
+    // holds for a fresh VM, anything else is treated as a cache miss
+    for (uint32_t slot = 0; slot != header.globalCount; ++slot) {
+        const char *chars;
+        uint32_t length;
+        if (!readString(reader, &chars, &length)) { return false; }
+        if (vm.getGlobals().slot(copyString(vm, chars, length)) != static_cast<int>(slot)) { return false; }
+    }
+    return reader.atEnd();
+}
+
+// the interpreter, the register compiler and the JIT trust the code they run, so the code of a file is only accepted if
+// every opcode is known, every operand names a constant or global slot the file has, the stack stays within its bounds
+// and the last instruction is OP_RETURN; the payload hash only catches accidental damage
+bool BytecodeCache::verify(const Chunk &chunk, uint32_t globalCount)
+{
+    const std::vector<uint8_t> &code = chunk.code;
+    size_t depth = 0;
+    OpCode last = OP_POP;
+    for (size_t offset = 0; offset < code.size();) {
+        OpCode op = static_cast<OpCode>(code[offset]);
+        size_t size = 1 + operandSize(op);
+        if (code.size() - offset < size) { return false; }
+
+        // a superinstruction is checked part by part, each with its one byte operand
+        const Superinstruction *super = findSuperinstruction(op);
+        const OpCode *parts = super != nullptr ? super->parts : &op;
+        int partCount = super != nullptr ? super->length : 1;
+        const uint8_t *operand = &code[offset + 1];
+        for (int i = 0; i != partCount; ++i) {
+            OpCode part = parts[i];
+            size_t pops;
+            size_t pushes;
+            if (!stackEffect(part, &pops, &pushes) || depth < pops) { return false; }
+
+            int operandBytes = super != nullptr ? std::min(operandSize(part), 1) : operandSize(part);
+            uint32_t index = 0;
+            for (int byte = 0; byte != operandBytes; ++byte) { index |= static_cast<uint32_t>(*operand++) << 8 * byte; }
+            switch (part) {
+            case OP_CONSTANT:
+            case OP_CONSTANT_LONG:
+                if (index >= chunk.constants.values.size()) { return false; }
+                break;
+            case OP_DEFINE_GLOBAL:
+            case OP_DEFINE_GLOBAL_LONG:
+            case OP_GET_GLOBAL:
+            case OP_GET_GLOBAL_LONG:
+            case OP_SET_GLOBAL:
+            case OP_SET_GLOBAL_LONG:
+                if (index >= globalCount) { return false; }
+                break;
+            default:
+                break;
+            }
+
+            depth = depth - pops + pushes;
+            if (depth > STACK_MAX) { return false; }
+        }
+        last = op;
+        offset += size;
+    }
+    return last == OP_RETURN;
+}
+
+bool BytecodeCache::load(VM &vm, const std::string &path, std::string_view source, Chunk &chunk)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) { return false; }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void *mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) { return false; }
+
+    VM::ChunkScope scope(vm, &chunk);
+    bool loaded = parse(vm, static_cast<const char *>(mapping), st.st_size, source, chunk);
+    munmap(mapping, st.st_size);
+    if (!loaded) { chunk = Chunk(); }
+    return loaded;
+}
+
+void BytecodeCache::store(VM &vm, const std::string &path, std::string_view source, const Chunk &chunk)
+{
+    const Globals &globals = vm.getGlobals();
+
+    Writer writer;
+    writer.write(chunk.code.data(), chunk.code.size());
+    writer.write(chunk.lines.data(), chunk.lines.size() * sizeof(chunk.lines[0]));
+    for (Value value : chunk.constants.values) {
+        if (IS_NIL(value)) {
+            writer.write(TAG_CONSTANT_NIL);
+        } else if (IS_BOOL(value)) {
+            writer.write(AS_BOOL(value) ? TAG_CONSTANT_TRUE : TAG_CONSTANT_FALSE);
+        } else if (IS_NUMBER(value)) {
+            writer.write(TAG_CONSTANT_NUMBER);
+            writer.write(AS_NUMBER(value));
+        } else {
+            writer.write(TAG_CONSTANT_STRING);
+            writeString(writer, AS_STRING(value));
+        }
+    }
+    for (int slot = 0; slot != globals.count(); ++slot) { writeString(writer, globals.name(slot)); }
+
+    Header header{};
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = CACHE_VERSION;
+    header.optimizationLevel = static_cast<uint32_t>(vm.getOptions().optimizationLevel);
+    header.sourceHash = hashBytes(source);
+    header.payloadHash = hashBytes(writer.data());
+    header.codeSize = static_cast<uint32_t>(chunk.code.size());
+    header.lineRunCount = static_cast<uint32_t>(chunk.lines.size());
+    header.constantCount = static_cast<uint32_t>(chunk.constants.values.size());
+    header.globalCount = static_cast<uint32_t>(globals.count());
+
+    // written under a temporary name and renamed, so that a concurrent run never maps a half-written file
+    std::string temporary = path + ".tmp";
+    FILE *file = fopen(temporary.c_str(), "wb");
+    if (file == nullptr) { return; }
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(writer.data().data(), 1, writer.data().size(), file) == writer.data().size();
+    if (fclose(file) != 0 || !written || rename(temporary.c_str(), path.c_str()) != 0) { remove(temporary.c_str()); }
+}
@@ -0,0 +1,35 @@
+#ifndef CXXLOX_CACHE_H
+#define CXXLOX_CACHE_H
+
+#include <string>
+#include <string_view>
+
+#include "chunk.h"
+#include "vm.h"
+
+// Compiled chunks persisted next to their source file ("script.lox" -> "script.loxc"), so that running an unchanged
+// script again skips the scanner and the compiler.
+//
+// A cache file is a header followed by the code, the line table, the constants and the names of the global slots the
+// code refers to, all in native byte order. It is only used if its version matches CACHE_VERSION, its source hash
+// matches the hash of the current source and it was compiled at the current optimization level.
+class BytecodeCache
+{
+public:
+    // bump whenever the file layout or the meaning of any opcode changes
+    static constexpr uint32_t CACHE_VERSION = 7;
+
+    static std::string pathFor(const char *sourcePath) { return std::string(sourcePath) + "c"; }
+
+    // maps the cache file and rebuilds the chunk from it, interning its strings and resolving its globals in vm;
+    // returns false if there is no usable cache for source
+    static bool load(VM &vm, const std::string &path, std::string_view source, Chunk &chunk);
+
+    // failures are silently ignored, the cache is only an optimization
+    static void store(VM &vm, const std::string &path, std::string_view source, const Chunk &chunk);
+
+private:
+    static bool parse(VM &vm, const char *data, size_t size, std::string_view source, Chunk &chunk);
+    static bool verify(const Chunk &chunk, uint32_t globalCount);
+};
+#endif
@@ -1 +1,177 @@
 #include "chunk.h"
+
+#include <algorithm>
+#include <bit>
+#include <functional>
+
+int operandSize(OpCode op)
+{
+    switch (op) {
+    case OP_CONSTANT:
+    case OP_DEFINE_GLOBAL:
+    case OP_GET_GLOBAL:
+    case OP_IMPORT:
+    case OP_SET_GLOBAL:
+        return 1;
+    case OP_CONSTANT_LONG:
+    case OP_DEFINE_GLOBAL_LONG:
+    case OP_GET_GLOBAL_LONG:
+    case OP_IMPORT_LONG:
+    case OP_SET_GLOBAL_LONG:
+        return 3;
+    case OP_R_IMPORT:
+    case OP_R_PRINT:
+        return 1;
+    case OP_R_DEFINE_GLOBAL:
+    case OP_R_GET_GLOBAL:
+    case OP_R_LOAD_CONSTANT:
+    case OP_R_NEGATE:
+    case OP_R_NOT:
+    case OP_R_SET_GLOBAL:
+        return 2;
+    case OP_R_ADD:
+    case OP_R_ADD_K:
+    case OP_R_DIVIDE:
+    case OP_R_DIVIDE_K:
+    case OP_R_EQUAL:
+    case OP_R_EQUAL_K:
+    case OP_R_GREATER:
+    case OP_R_GREATER_K:
+    case OP_R_GREATER_EQUAL:
+    case OP_R_GREATER_EQUAL_K:
+    case OP_R_IMPORT_LONG:
+    case OP_R_LESS:
+    case OP_R_LESS_K:
+    case OP_R_LESS_EQUAL:
+    case OP_R_LESS_EQUAL_K:
+    case OP_R_MULTIPLY:
+    case OP_R_MULTIPLY_K:
+    case OP_R_NOT_EQUAL:
+    case OP_R_NOT_EQUAL_K:
+    case OP_R_SUBTRACT:
+    case OP_R_SUBTRACT_K:
+        return 3;
+    case OP_R_DEFINE_GLOBAL_LONG:
+    case OP_R_GET_GLOBAL_LONG:
+    case OP_R_LOAD_CONSTANT_LONG:
+    case OP_R_SET_GLOBAL_LONG:
+        return 4;
+    default:
+        break;
+    }
+    const Superinstruction *super = findSuperinstruction(op);
+    if (super == nullptr) { return 0; }
+    int size = 0;
+    for (int i = 0; i != super->length; ++i) { size += operandSize(super->parts[i]); }
+    return size;
+}
+
+const Superinstruction *findSuperinstruction(OpCode op)
+{
+    for (const Superinstruction &super : SUPERINSTRUCTIONS) {
+        if (super.op == op) { return &super; }
+    }
+    return nullptr;
+}
+
+OpCode genericForm(OpCode op)
+{
+    switch (op) {
+    case OP_ADD_NUM:
+    case OP_ADD_STR:
+    case OP_ADD_GENERIC:
+        return OP_ADD;
+    case OP_EQUAL_NUM:
+    case OP_EQUAL_GENERIC:
+        return OP_EQUAL;
+    case OP_NOT_EQUAL_NUM:
+    case OP_NOT_EQUAL_GENERIC:
+        return OP_NOT_EQUAL;
+    default:
+        return op;
+    }
+}
+
+static OpCode longForm(OpCode op)
+{
+    switch (op) {
+    case OP_CONSTANT:
+        return OP_CONSTANT_LONG;
+    case OP_DEFINE_GLOBAL:
+        return OP_DEFINE_GLOBAL_LONG;
+    case OP_GET_GLOBAL:
+        return OP_GET_GLOBAL_LONG;
+    case OP_IMPORT:
+        return OP_IMPORT_LONG;
+    case OP_R_IMPORT:
+        return OP_R_IMPORT_LONG;
+    case OP_SET_GLOBAL:
+        return OP_SET_GLOBAL_LONG;
+    default:
+        return op;
+    }
+}
+
+static uint64_t representation(Value value)
+{
+#ifdef NAN_BOXING
+    return value;
+#else
+    // only the union member of the value's own type is initialized
+    switch (value.type) {
+    case VAL_BOOL:
+        return AS_BOOL(value);
+    case VAL_NUMBER:
+        return std::bit_cast<uint64_t>(AS_NUMBER(value));
+    case VAL_OBJ:
+        return reinterpret_cast<uintptr_t>(AS_OBJ(value));
+    default:
+        return 0;
+    }
+#endif
+}
+
+size_t ConstantHash::operator()(Value value) const { return std::hash<uint64_t>()(representation(value)); }
+
+bool ConstantEqual::operator()(Value a, Value b) const
+{
+#ifdef NAN_BOXING
+    return a == b;
+#else
+    return a.type == b.type && representation(a) == representation(b);
+#endif
+}
+
+int Chunk::addConstant(Value value)
+{
+    auto [entry, inserted] = constantIndex.try_emplace(value, static_cast<int>(constants.count()));
+    if (inserted) { constants.write(value); }
+    return entry->second;
+}
+
+void Chunk::writeOperand(OpCode op, uint32_t operand, unsigned line)
+{
+    if (operand <= MAX_SHORT_OPERAND) {
+        write(op, line);
+        write(static_cast<uint8_t>(operand), line);
+        return;
+    }
+    write(longForm(op), line);
+    write(static_cast<uint8_t>(operand), line);
+    write(static_cast<uint8_t>(operand >> 8), line);
+    write(static_cast<uint8_t>(operand >> 16), line);
+}
+
+// the operand of a plain instruction; a superinstruction's operands are read byte by byte
+uint32_t Chunk::readOperand(size_t offset) const
+{
+    if (operandSize(static_cast<OpCode>(code[offset])) == 1) { return code[offset + 1]; }
+    return code[offset + 1] | code[offset + 2] << 8 | code[offset + 3] << 16;
+}
+
+unsigned Chunk::getLine(size_t offset) const
+{
+    // the last run starting at or before offset
+    auto run = std::upper_bound(lines.begin(), lines.end(), offset, [](size_t offset, const LineRun &run) { return offset < run.offset; });
+    return std::prev(run)->line;
+}
@@ -1,56 +1,197 @@
 #ifndef CXXLOX_CHUNK_H
 #define CXXLOX_CHUNK_H
 
+#include <unordered_map>
 #include <vector>
 
 #include "common.h"
 #include "value.h"
 
-enum OpCode
+enum OpCode : uint8_t
 {
     OP_ADD,
     OP_CONSTANT,
+    OP_CONSTANT_LONG,
     OP_DEFINE_GLOBAL,
+    OP_DEFINE_GLOBAL_LONG,
     OP_DIVIDE,
     OP_EQUAL,
     OP_FALSE,
     OP_GET_GLOBAL,
+    OP_GET_GLOBAL_LONG,
     OP_GREATER,
+    OP_GREATER_EQUAL,
+    OP_IMPORT,
+    OP_IMPORT_LONG,
     OP_LESS,
+    OP_LESS_EQUAL,
     OP_MULTIPLY,
     OP_NIL,
     OP_NOT,
+    OP_NOT_EQUAL,
     OP_NEGATE,
     OP_POP,
     OP_PRINT,
     OP_RETURN,
     OP_SET_GLOBAL,
+    OP_SET_GLOBAL_LONG,
     OP_SUBTRACT,
     OP_TRUE,
+
+    // superinstructions, see SUPERINSTRUCTIONS
+    OP_GET_GLOBAL_ADD_SET_GLOBAL,
+    OP_GET_GLOBAL_CONSTANT_ADD,
+    OP_GET_GLOBAL_CONSTANT_DIVIDE,
+    OP_GET_GLOBAL_GET_GLOBAL,
+    OP_GET_GLOBAL_MULTIPLY_ADD,
+    OP_SET_GLOBAL_POP,
+
+    // quickened forms, which VM::run() rewrites an instruction to once it has seen the types of its operands, and the
+    // *_GENERIC forms it rewrites them to when the types change, which never quicken again; so an instruction that sees
+    // several types is rewritten twice at most. See Chunk::quicken()
+    OP_ADD_NUM,
+    OP_ADD_STR,
+    OP_EQUAL_NUM,
+    OP_NOT_EQUAL_NUM,
+    OP_ADD_GENERIC,
+    OP_EQUAL_GENERIC,
+    OP_NOT_EQUAL_GENERIC,
+
+    // register instructions, see register.h
+    OP_R_ADD,
+    OP_R_ADD_K,
+    OP_R_DEFINE_GLOBAL,
+    OP_R_DEFINE_GLOBAL_LONG,
+    OP_R_DIVIDE,
+    OP_R_DIVIDE_K,
+    OP_R_EQUAL,
+    OP_R_EQUAL_K,
+    OP_R_GET_GLOBAL,
+    OP_R_GET_GLOBAL_LONG,
+    OP_R_GREATER,
+    OP_R_GREATER_K,
+    OP_R_GREATER_EQUAL,
+    OP_R_GREATER_EQUAL_K,
+    OP_R_IMPORT,
+    OP_R_IMPORT_LONG,
+    OP_R_LESS,
+    OP_R_LESS_K,
+    OP_R_LESS_EQUAL,
+    OP_R_LESS_EQUAL_K,
+    OP_R_LOAD_CONSTANT,
+    OP_R_LOAD_CONSTANT_LONG,
+    OP_R_MULTIPLY,
+    OP_R_MULTIPLY_K,
+    OP_R_NEGATE,
+    OP_R_NOT,
+    OP_R_NOT_EQUAL,
+    OP_R_NOT_EQUAL_K,
+    OP_R_PRINT,
+    OP_R_RETURN,
+    OP_R_SET_GLOBAL,
+    OP_R_SET_GLOBAL_LONG,
+    OP_R_SUBTRACT,
+    OP_R_SUBTRACT_K,
+};
+
+// instructions that take a constant index, a global slot or a module index come in two forms: a one byte operand, and a three byte
+// little-endian one for the OP_*_LONG variant
+constexpr uint32_t MAX_SHORT_OPERAND = UINT8_MAX;
+constexpr uint32_t MAX_LONG_OPERAND = (1u << 24) - 1;
+
+// number of operand bytes following the opcode
+int operandSize(OpCode op);
+
+// A superinstruction does the work of a sequence of instructions with a single dispatch. Its operands are the one byte
+// operands of its parts, in order, so the optimizer (at -O2) only fuses a sequence if all its operands fit the short
+// form, and only if it does not span lines, since the fused instruction reports errors against a single line.
+//
+// The set and its order are what bench/superinstructions.py chooses from the benchmark corpus: the candidates that save
+// at least 3% of dispatches. At each instruction the optimizer fuses the first entry that matches.
+struct Superinstruction
+{
+    OpCode op;
+    int length;
+    OpCode parts[3];
+};
+
+inline constexpr Superinstruction SUPERINSTRUCTIONS[] = {
+    {OP_GET_GLOBAL_ADD_SET_GLOBAL, 3, {OP_GET_GLOBAL, OP_ADD, OP_SET_GLOBAL}},
+    {OP_GET_GLOBAL_GET_GLOBAL, 2, {OP_GET_GLOBAL, OP_GET_GLOBAL}},
+    {OP_SET_GLOBAL_POP, 2, {OP_SET_GLOBAL, OP_POP}},
+    {OP_GET_GLOBAL_MULTIPLY_ADD, 3, {OP_GET_GLOBAL, OP_MULTIPLY, OP_ADD}},
+    {OP_GET_GLOBAL_CONSTANT_DIVIDE, 3, {OP_GET_GLOBAL, OP_CONSTANT, OP_DIVIDE}},
+    {OP_GET_GLOBAL_CONSTANT_ADD, 3, {OP_GET_GLOBAL, OP_CONSTANT, OP_ADD}},
+};
+
+// nullptr unless op is a superinstruction
+const Superinstruction *findSuperinstruction(OpCode op);
+
+// the generic instruction a quickened one was rewritten from, or op itself; for passes that read code which may have
+// run already
+OpCode genericForm(OpCode op);
+
+// the pool is deduplicated on the representation of a value rather than on valuesEqual(), so that 0 and -0, or NaNs
+// with different payloads, keep entries of their own; strings are interned, so equal strings share an entry
+struct ConstantHash
+{
+    size_t operator()(Value value) const;
+};
+
+struct ConstantEqual
+{
+    bool operator()(Value a, Value b) const;
+};
+
+// one entry per run of bytes compiled from the same line: most lines compile to several instructions, so this is far
+// smaller than a line number per byte
+struct LineRun
+{
+    uint32_t offset;  // of the first byte of the run
+    unsigned line;
 };
 
 class Chunk
 {
+    friend class BytecodeCache;
     friend class Disassembler;
+    friend class JitCompiler;
+    friend class ModuleLoader;
+    friend class NativeRuntime;
+    friend class OpcodeStats;
+    friend class Optimizer;
+    friend class Profiler;
+    friend class RegisterCompiler;
+    friend class Transpiler;
     friend class VM;
 
 public:
     void write(uint8_t byte, unsigned line)
     {
+        if (lines.empty() || lines.back().line != line) { lines.push_back(LineRun{static_cast<uint32_t>(code.size()), line}); }
         code.push_back(byte);
-        lines.push_back(line);
     }
 
-    int addConstant(Value value)
-    {
-        constants.write(value);
-        return constants.count() - 1;
-    }
+    // returns the index of an identical constant if the pool already has one
+    int addConstant(Value value);
+
+    // writes op with its short or long operand, whichever fits
+    void writeOperand(OpCode op, uint32_t operand, unsigned line);
+
+    uint32_t readOperand(size_t offset) const;
+
+    // line the byte at offset was compiled from
+    unsigned getLine(size_t offset) const;
+
+    // rewrites the opcode at offset, which takes no operands, to another form of the same instruction; the only change
+    // made to code once it runs, which is why the VM takes the chunks it executes non-const
+    void quicken(size_t offset, OpCode op) { code[offset] = op; }
 
 private:
     std::vector<uint8_t> code;
-    std::vector<unsigned> lines;
+    std::vector<LineRun> lines;
     ValueArray constants;
+    std::unordered_map<Value, int, ConstantHash, ConstantEqual> constantIndex;
 
     std::vector<uint8_t>::size_type count() { return code.size(); }
 };
@@ -1,8 +1,21 @@
 #ifndef CXXLOX_COMMON_H
 #define CXXLOX_COMMON_H
 
-#define DEBUG_PRINT_CODE
-#define DEBUG_TRACE_EXECUTION
+// pack every Value into a single 64-bit word instead of a 16-byte tagged union
+#define NAN_BOXING
+
+// dispatch through a table of label addresses (GCC's labels-as-values) instead of the switch when available
+#if defined(__GNUC__) && !defined(NO_COMPUTED_GOTO)
+#define COMPUTED_GOTO
+#endif
+
+// compile chunks to machine code with --jit; the code generator only targets x86-64 Linux, and NaN-boxed values
+#if defined(__x86_64__) && defined(__linux__) && defined(NAN_BOXING)
+#define JIT_COMPILER
+#endif
+
+// collect garbage before every allocation that grows the heap
+// #define DEBUG_STRESS_GC
 
 #include <stddef.h>
 #include <stdint.h>
@@ -2,13 +2,12 @@
 
 #include "chunk.h"
 #include "compiler.h"
-#include "scanner.h"
-
-#ifdef DEBUG_PRINT_CODE
 #include "debug.h"
-#endif
+#include "module.h"
+#include "optimizer.h"
+#include "scanner.h"
 
-bool Compiler::compile(const std::string &source, Chunk &chunk)
+bool Compiler::compile(std::string_view source, Chunk &chunk)
 {
     scanner = std::make_unique<Scanner>(source);
     compileChunk = &chunk;
@@ -37,17 +36,17 @@ void Compiler::errorAt(const Token &token, const char *message)
     if (parser.panicMode) return;
     parser.panicMode = true;
 
-    fprintf(stderr, "[line %d] Error", token.line);
+    fprintf(errors, "[line %d] Error", token.line);
 
     if (token.type == TOKEN_EOF) {
-        fprintf(stderr, " at end");
+        fprintf(errors, " at end");
     } else if (token.type == TOKEN_ERROR) {
         // Nothing.
     } else {
-        fprintf(stderr, " at '%.*s'", token.length, token.start);
+        fprintf(errors, " at '%.*s'", token.length, token.start);
     }
 
-    fprintf(stderr, ": %s\n", message);
+    fprintf(errors, ": %s\n", message);
     parser.hadError = true;
 }
 
@@ -60,14 +59,24 @@ void Compiler::consume(TokenType type, const char *message)
     errorAtCurrent(message);
 }
 
-uint8_t Compiler::makeConstant(Value value)
+uint32_t Compiler::makeConstant(Value value)
 {
     int constant = currentChunk()->addConstant(value);
-    if (constant > UINT8_MAX) {
+    if (static_cast<uint32_t>(constant) > MAX_LONG_OPERAND) {
         error("Too many constants in one chunk.");
         return 0;
     }
-    return static_cast<uint8_t>(constant);
+    return static_cast<uint32_t>(constant);
+}
+
+uint32_t Compiler::globalSlot(const Token &name)
+{
+    int slot = vm.getGlobals().slot(copyString(vm, name.start, name.length));
+    if (static_cast<uint32_t>(slot) > MAX_LONG_OPERAND) {
+        error("Too many global variables.");
+        return 0;
+    }
+    return static_cast<uint32_t>(slot);
 }
 
 void Compiler::unary(bool canAssign)
@@ -116,6 +125,7 @@ ParseRule Compiler::rules[] = {
     [TOKEN_FOR] = {nullptr, nullptr, PREC_NONE},
     [TOKEN_FUN] = {nullptr, nullptr, PREC_NONE},
     [TOKEN_IF] = {nullptr, nullptr, PREC_NONE},
+    [TOKEN_IMPORT] = {nullptr, nullptr, PREC_NONE},
     [TOKEN_NIL] = {&Compiler::literal, nullptr, PREC_NONE},
     [TOKEN_OR] = {nullptr, nullptr, PREC_NONE},
     [TOKEN_PRINT] = {nullptr, nullptr, PREC_NONE},
@@ -194,9 +204,9 @@ void Compiler::parsePrecedence(Precedence precedence)
 void Compiler::endCompiler()
 {
     emitReturn();
-#ifdef DEBUG_PRINT_CODE
-    if (!parser.hadError) { disassembleChunk(*currentChunk(), "code"); }
-#endif
+    if (options.optimizationLevel >= 1 && !parser.hadError) { optimizeChunk(vm, *currentChunk(), options.optimizationLevel); }
+    if (options.opcodeStats != nullptr && !parser.hadError) { options.opcodeStats->count(*currentChunk()); }
+    if (options.printCode && !parser.hadError) { disassembleChunk(*currentChunk(), "code", vm.getGlobals()); }
 }
 
 
@@ -231,6 +241,8 @@ void Compiler::statement()
 {
     if (match(TOKEN_PRINT)) {
         printStatement();
+    } else if (match(TOKEN_IMPORT)) {
+        importStatement();
     } else {
         expressionStatement();
     }
@@ -250,6 +262,19 @@ void Compiler::printStatement()
     emitByte(OP_PRINT);
 }
 
+// the module is queued for a worker right away, so that it compiles while the rest of this file does
+void Compiler::importStatement()
+{
+    consume(TOKEN_STRING, "Expect module path after 'import'.");
+    uint32_t module = 0;
+    if (parser.previous.type == TOKEN_STRING) {
+        std::string_view path(parser.previous.start + 1, parser.previous.length - 2);
+        module = modules.request(directory, path, options.optimizationLevel);
+    }
+    consume(TOKEN_SEMICOLON, "Expect ';' after module path.");
+    emitOperand(OP_IMPORT, module);
+}
+
 void Compiler::expressionStatement()
 {
     expression();
@@ -270,6 +295,7 @@ void Compiler::synchronize()
         case TOKEN_VAR:
         case TOKEN_FOR:
         case TOKEN_IF:
+        case TOKEN_IMPORT:
         case TOKEN_WHILE:
         case TOKEN_PRINT:
         case TOKEN_RETURN:
@@ -278,13 +304,13 @@ void Compiler::synchronize()
             // Do nothing.
             ;
         }
+        advance();
     }
-    advance();
 }
 
 void Compiler::varDeclaration()
 {
-    uint8_t global = parseVariable("Expect variable name.");
+    uint32_t global = parseVariable("Expect variable name.");
     if (match(TOKEN_EQUAL)) {
         expression();
     } else {
@@ -296,11 +322,11 @@ void Compiler::varDeclaration()
 
 void Compiler::namedVariable(Token name, bool canAssign)
 {
-    uint8_t arg = identifierConstant(name);
+    uint32_t arg = globalSlot(name);
     if (canAssign && match(TOKEN_EQUAL)) {
         expression();
-        emitBytes(OP_SET_GLOBAL, arg);
+        emitOperand(OP_SET_GLOBAL, arg);
     } else {
-        emitBytes(OP_GET_GLOBAL, arg);
+        emitOperand(OP_GET_GLOBAL, arg);
     }
 }
@@ -1,8 +1,10 @@
 #ifndef CXXLOX_COMPILER_H
 #define CXXLOX_COMPILER_H
 
+#include <cstdio>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <type_traits>
 
 #include "scanner.h"
@@ -33,6 +35,7 @@ enum Precedence
 };
 
 class Compiler;
+class ModuleLoader;
 using ParseFn = void (Compiler::*)(bool canAssign);
 
 struct ParseRule
@@ -47,9 +50,20 @@ class Compiler
     friend struct ParseRule;
 
 public:
-    bool compile(const std::string &source, Chunk &chunk);
+    // imports are requested from modules, relative to directory; errors are printed to errors
+    Compiler(VM &vm, const InterpretOptions &options, ModuleLoader &modules, std::string directory, FILE *errors = stderr)
+        : vm(vm), options(options), modules(modules), directory(std::move(directory)), errors(errors)
+    {
+    }
+
+    bool compile(std::string_view source, Chunk &chunk);
 
 private:
+    VM &vm;
+    const InterpretOptions &options;
+    ModuleLoader &modules;
+    std::string directory;
+    FILE *errors;
     Parser parser;
     Chunk *compileChunk;
     std::unique_ptr<Scanner> scanner;
@@ -67,17 +81,15 @@ private:
 
     void printStatement();
 
+    void importStatement();
+
     void expressionStatement();
 
     void expression() { parsePrecedence(PREC_ASSIGNMENT); }
 
-    void number(bool canAssign)
-    {
-        double value = strtod(parser.previous.start, NULL);
-        emitConstant(NUMBER_VAL(value));
-    }
+    void number(bool canAssign) { emitConstant(NUMBER_VAL(parser.previous.number)); }
 
-    void string(bool canAssign) { emitConstant(OBJ_VAL(copyString(parser.previous.start + 1, parser.previous.length - 2))); }
+    void string(bool canAssign) { emitConstant(OBJ_VAL(copyString(vm, parser.previous.start + 1, parser.previous.length - 2))); }
 
     void grouping(bool canAssign)
     {
@@ -119,21 +131,23 @@ private:
         emitByte(byte2);
     }
 
-    void emitConstant(Value value) { emitBytes(OP_CONSTANT, makeConstant(value)); }
+    void emitOperand(OpCode op, uint32_t operand) { currentChunk()->writeOperand(op, operand, parser.previous.line); }
+
+    void emitConstant(Value value) { emitOperand(OP_CONSTANT, makeConstant(value)); }
 
-    uint8_t makeConstant(Value value);
+    uint32_t makeConstant(Value value);
 
     void parsePrecedence(Precedence precedence);
 
-    uint8_t identifierConstant(Token &name) { return makeConstant(OBJ_VAL(copyString(name.start, name.length))); }
+    uint32_t globalSlot(const Token &name);
 
-    uint8_t parseVariable(const char *errorMessage)
+    uint32_t parseVariable(const char *errorMessage)
     {
         consume(TOKEN_IDENTIFIER, errorMessage);
-        return identifierConstant(parser.previous);
+        return globalSlot(parser.previous);
     }
 
-    void defineVariable(uint8_t global) { emitBytes(OP_DEFINE_GLOBAL, global); }
+    void defineVariable(uint32_t global) { emitOperand(OP_DEFINE_GLOBAL, global); }
 
     void variable(bool canAssign) { namedVariable(parser.previous, canAssign); }
 
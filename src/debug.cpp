@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <iostream>
+#include <vector>
 
 #include "chunk.h"
 #include "debug.h"
@@ -10,74 +12,342 @@ static int simpleInstruction(const char *name, int offset)
     return offset + 1;
 }
 
+const char *opcodeName(OpCode op)
+{
+    switch (op) {
+    case OP_ADD:
+        return "OP_ADD";
+    case OP_CONSTANT:
+        return "OP_CONSTANT";
+    case OP_CONSTANT_LONG:
+        return "OP_CONSTANT_LONG";
+    case OP_DEFINE_GLOBAL:
+        return "OP_DEFINE_GLOBAL";
+    case OP_DEFINE_GLOBAL_LONG:
+        return "OP_DEFINE_GLOBAL_LONG";
+    case OP_DIVIDE:
+        return "OP_DIVIDE";
+    case OP_EQUAL:
+        return "OP_EQUAL";
+    case OP_FALSE:
+        return "OP_FALSE";
+    case OP_GET_GLOBAL:
+        return "OP_GET_GLOBAL";
+    case OP_GET_GLOBAL_LONG:
+        return "OP_GET_GLOBAL_LONG";
+    case OP_GREATER:
+        return "OP_GREATER";
+    case OP_GREATER_EQUAL:
+        return "OP_GREATER_EQUAL";
+    case OP_IMPORT:
+        return "OP_IMPORT";
+    case OP_IMPORT_LONG:
+        return "OP_IMPORT_LONG";
+    case OP_LESS:
+        return "OP_LESS";
+    case OP_LESS_EQUAL:
+        return "OP_LESS_EQUAL";
+    case OP_MULTIPLY:
+        return "OP_MULTIPLY";
+    case OP_NIL:
+        return "OP_NIL";
+    case OP_NOT:
+        return "OP_NOT";
+    case OP_NOT_EQUAL:
+        return "OP_NOT_EQUAL";
+    case OP_NEGATE:
+        return "OP_NEGATE";
+    case OP_POP:
+        return "OP_POP";
+    case OP_PRINT:
+        return "OP_PRINT";
+    case OP_RETURN:
+        return "OP_RETURN";
+    case OP_SET_GLOBAL:
+        return "OP_SET_GLOBAL";
+    case OP_SET_GLOBAL_LONG:
+        return "OP_SET_GLOBAL_LONG";
+    case OP_SUBTRACT:
+        return "OP_SUBTRACT";
+    case OP_TRUE:
+        return "OP_TRUE";
+    case OP_GET_GLOBAL_ADD_SET_GLOBAL:
+        return "OP_GET_GLOBAL_ADD_SET_GLOBAL";
+    case OP_GET_GLOBAL_CONSTANT_ADD:
+        return "OP_GET_GLOBAL_CONSTANT_ADD";
+    case OP_GET_GLOBAL_CONSTANT_DIVIDE:
+        return "OP_GET_GLOBAL_CONSTANT_DIVIDE";
+    case OP_GET_GLOBAL_GET_GLOBAL:
+        return "OP_GET_GLOBAL_GET_GLOBAL";
+    case OP_GET_GLOBAL_MULTIPLY_ADD:
+        return "OP_GET_GLOBAL_MULTIPLY_ADD";
+    case OP_SET_GLOBAL_POP:
+        return "OP_SET_GLOBAL_POP";
+    case OP_ADD_NUM:
+        return "OP_ADD_NUM";
+    case OP_ADD_STR:
+        return "OP_ADD_STR";
+    case OP_EQUAL_NUM:
+        return "OP_EQUAL_NUM";
+    case OP_NOT_EQUAL_NUM:
+        return "OP_NOT_EQUAL_NUM";
+    case OP_ADD_GENERIC:
+        return "OP_ADD_GENERIC";
+    case OP_EQUAL_GENERIC:
+        return "OP_EQUAL_GENERIC";
+    case OP_NOT_EQUAL_GENERIC:
+        return "OP_NOT_EQUAL_GENERIC";
+    case OP_R_ADD:
+        return "OP_R_ADD";
+    case OP_R_ADD_K:
+        return "OP_R_ADD_K";
+    case OP_R_DEFINE_GLOBAL:
+        return "OP_R_DEFINE_GLOBAL";
+    case OP_R_DEFINE_GLOBAL_LONG:
+        return "OP_R_DEFINE_GLOBAL_LONG";
+    case OP_R_DIVIDE:
+        return "OP_R_DIVIDE";
+    case OP_R_DIVIDE_K:
+        return "OP_R_DIVIDE_K";
+    case OP_R_EQUAL:
+        return "OP_R_EQUAL";
+    case OP_R_EQUAL_K:
+        return "OP_R_EQUAL_K";
+    case OP_R_GET_GLOBAL:
+        return "OP_R_GET_GLOBAL";
+    case OP_R_GET_GLOBAL_LONG:
+        return "OP_R_GET_GLOBAL_LONG";
+    case OP_R_GREATER:
+        return "OP_R_GREATER";
+    case OP_R_GREATER_K:
+        return "OP_R_GREATER_K";
+    case OP_R_GREATER_EQUAL:
+        return "OP_R_GREATER_EQUAL";
+    case OP_R_GREATER_EQUAL_K:
+        return "OP_R_GREATER_EQUAL_K";
+    case OP_R_IMPORT:
+        return "OP_R_IMPORT";
+    case OP_R_IMPORT_LONG:
+        return "OP_R_IMPORT_LONG";
+    case OP_R_LESS:
+        return "OP_R_LESS";
+    case OP_R_LESS_K:
+        return "OP_R_LESS_K";
+    case OP_R_LESS_EQUAL:
+        return "OP_R_LESS_EQUAL";
+    case OP_R_LESS_EQUAL_K:
+        return "OP_R_LESS_EQUAL_K";
+    case OP_R_LOAD_CONSTANT:
+        return "OP_R_LOAD_CONSTANT";
+    case OP_R_LOAD_CONSTANT_LONG:
+        return "OP_R_LOAD_CONSTANT_LONG";
+    case OP_R_MULTIPLY:
+        return "OP_R_MULTIPLY";
+    case OP_R_MULTIPLY_K:
+        return "OP_R_MULTIPLY_K";
+    case OP_R_NEGATE:
+        return "OP_R_NEGATE";
+    case OP_R_NOT:
+        return "OP_R_NOT";
+    case OP_R_NOT_EQUAL:
+        return "OP_R_NOT_EQUAL";
+    case OP_R_NOT_EQUAL_K:
+        return "OP_R_NOT_EQUAL_K";
+    case OP_R_PRINT:
+        return "OP_R_PRINT";
+    case OP_R_RETURN:
+        return "OP_R_RETURN";
+    case OP_R_SET_GLOBAL:
+        return "OP_R_SET_GLOBAL";
+    case OP_R_SET_GLOBAL_LONG:
+        return "OP_R_SET_GLOBAL_LONG";
+    case OP_R_SUBTRACT:
+        return "OP_R_SUBTRACT";
+    case OP_R_SUBTRACT_K:
+        return "OP_R_SUBTRACT_K";
+    default:
+        return nullptr;
+    }
+}
+
 int Disassembler::constantInstruction(const char *name, const Chunk &chunk, int offset)
 {
-    auto constant = chunk.code[offset + 1];
-    printf("%-16s %4d '", name, constant);
+    uint32_t constant = chunk.readOperand(offset);
+    printf("%-16s %4u '", name, constant);
     printValue(chunk.constants.values[constant]);
     printf("'\n");
-    return offset + 2;
+    return offset + 1 + operandSize(static_cast<OpCode>(chunk.code[offset]));
+}
+
+int Disassembler::operandInstruction(const char *name, const Chunk &chunk, int offset)
+{
+    printf("%-16s %4u\n", name, chunk.readOperand(offset));
+    return offset + 1 + operandSize(static_cast<OpCode>(chunk.code[offset]));
+}
+
+int Disassembler::globalInstruction(const char *name, const Chunk &chunk, int offset, const Globals &globals)
+{
+    uint32_t slot = chunk.readOperand(offset);
+    printf("%-16s %4u '%s'\n", name, slot, globals.name(slot)->getChars());
+    return offset + 1 + operandSize(static_cast<OpCode>(chunk.code[offset]));
+}
+
+// register operands as rN, constant operands with their value and global slots with their name
+int Disassembler::registerInstruction(const char *name, const Chunk &chunk, int offset, const Globals &globals)
+{
+    OpCode op = static_cast<OpCode>(chunk.code[offset]);
+    const uint8_t *operands = &chunk.code[offset + 1];
+    printf("%-16s", name);
+    switch (op) {
+    case OP_R_DEFINE_GLOBAL:
+    case OP_R_DEFINE_GLOBAL_LONG:
+    case OP_R_GET_GLOBAL:
+    case OP_R_GET_GLOBAL_LONG:
+    case OP_R_SET_GLOBAL:
+    case OP_R_SET_GLOBAL_LONG: {
+        uint32_t slot = operandSize(op) == 2 ? operands[1] : operands[1] | operands[2] << 8 | operands[3] << 16;
+        printf(" r%u %4u '%s'\n", operands[0], slot, globals.name(slot)->getChars());
+        break;
+    }
+    case OP_R_LOAD_CONSTANT:
+    case OP_R_LOAD_CONSTANT_LONG: {
+        uint32_t constant = operandSize(op) == 2 ? operands[1] : operands[1] | operands[2] << 8 | operands[3] << 16;
+        printf(" r%u %4u '", operands[0], constant);
+        printValue(chunk.constants.values[constant]);
+        printf("'\n");
+        break;
+    }
+    case OP_R_ADD_K:
+    case OP_R_DIVIDE_K:
+    case OP_R_EQUAL_K:
+    case OP_R_GREATER_K:
+    case OP_R_GREATER_EQUAL_K:
+    case OP_R_LESS_K:
+    case OP_R_LESS_EQUAL_K:
+    case OP_R_MULTIPLY_K:
+    case OP_R_NOT_EQUAL_K:
+    case OP_R_SUBTRACT_K:
+        printf(" r%u r%u %4u '", operands[0], operands[1], operands[2]);
+        printValue(chunk.constants.values[operands[2]]);
+        printf("'\n");
+        break;
+    default:
+        for (int i = 0; i != operandSize(op); ++i) { printf(" r%u", operands[i]); }
+        printf("\n");
+        break;
+    }
+    return offset + 1 + operandSize(op);
+}
+
+// the operands of the parts in order, each printed like the operand of the plain instruction
+int Disassembler::superinstruction(const char *name, const Chunk &chunk, int offset, const Globals &globals)
+{
+    const Superinstruction *super = findSuperinstruction(static_cast<OpCode>(chunk.code[offset]));
+    printf("%-16s", name);
+    int operand = offset + 1;
+    for (int i = 0; i != super->length; ++i) {
+        if (super->parts[i] == OP_CONSTANT) {
+            printf(" %4d '", chunk.code[operand]);
+            printValue(chunk.constants.values[chunk.code[operand]]);
+            printf("'");
+        } else if (operandSize(super->parts[i]) != 0) {
+            printf(" %4d '%s'", chunk.code[operand], globals.name(chunk.code[operand])->getChars());
+        }
+        operand += operandSize(super->parts[i]);
+    }
+    printf("\n");
+    return operand;
 }
 
-void Disassembler::disassembleChunk(const Chunk &chunk, const char *name)
+void Disassembler::disassembleChunk(const Chunk &chunk, const char *name, const Globals &globals)
 {
     printf("== %s ==\n", name);
-    for (unsigned offset = 0; offset < chunk.code.size();) { offset = disassembleInstruction(chunk, offset); }
+    for (unsigned offset = 0; offset < chunk.code.size();) { offset = disassembleInstruction(chunk, offset, globals); }
 }
 
 
-int Disassembler::disassembleInstruction(const Chunk &chunk, int offset)
+int Disassembler::disassembleInstruction(const Chunk &chunk, int offset, const Globals &globals)
 {
-    printf("%04d", offset);
-    if (offset > 0 && chunk.lines[offset] == chunk.lines[offset - 1]) {
+    // the space keeps the columns apart once lines reach five digits
+    printf("%04d ", offset);
+    unsigned line = chunk.getLine(offset);
+    if (offset > 0 && line == chunk.getLine(offset - 1)) {
         printf("   | ");
     } else {
-        printf("%4d ", chunk.lines[offset]);
+        printf("%4u ", line);
     }
 
-    uint8_t instruction = chunk.code[offset];
+    OpCode instruction = static_cast<OpCode>(chunk.code[offset]);
+    const char *name = opcodeName(instruction);
+    if (name == nullptr) {
+        printf("Unknown opcode %d\n", instruction);
+        return offset + 1;
+    }
     switch (instruction) {
-    case OP_ADD:
-        return simpleInstruction("OP_ADD", offset);
     case OP_CONSTANT:
-        return constantInstruction("OP_CONSTANT", chunk, offset);
+    case OP_CONSTANT_LONG:
+        return constantInstruction(name, chunk, offset);
     case OP_DEFINE_GLOBAL:
-        return constantInstruction("OP_DEFINE_GLOBAL", chunk, offset);
-    case OP_DIVIDE:
-        return simpleInstruction("OP_DIVIDE", offset);
-    case OP_EQUAL:
-        return simpleInstruction("OP_EQUAL", offset);
-    case OP_FALSE:
-        return simpleInstruction("OP_FALSE", offset);
+    case OP_DEFINE_GLOBAL_LONG:
     case OP_GET_GLOBAL:
-        return constantInstruction("OP_GET_GLOBAL", chunk, offset);
-    case OP_GREATER:
-        return simpleInstruction("OP_GREATER", offset);
-    case OP_LESS:
-        return simpleInstruction("OP_LESS", offset);
-    case OP_MULTIPLY:
-        return simpleInstruction("OP_MULTIPLY", offset);
-    case OP_NEGATE:
-        return simpleInstruction("OP_NEGATE", offset);
-    case OP_NOT:
-        return simpleInstruction("OP_NOT", offset);
-    case OP_NIL:
-        return simpleInstruction("OP_NIL", offset);
-    case OP_PRINT:
-        return simpleInstruction("OP_PRINT", offset);
-    case OP_POP:
-        return simpleInstruction("OP_POP", offset);
-    case OP_RETURN:
-        return simpleInstruction("OP_RETURN", offset);
+    case OP_GET_GLOBAL_LONG:
     case OP_SET_GLOBAL:
-        return constantInstruction("OP_SET_GLOBAL", chunk, offset);
-    case OP_SUBTRACT:
-        return simpleInstruction("OP_SUBTRACT", offset);
-    case OP_TRUE:
-        return simpleInstruction("OP_TRUE", offset);
+    case OP_SET_GLOBAL_LONG:
+        return globalInstruction(name, chunk, offset, globals);
+    case OP_IMPORT:
+    case OP_IMPORT_LONG:
+    case OP_R_IMPORT:
+    case OP_R_IMPORT_LONG:
+        return operandInstruction(name, chunk, offset);
     default:
-        printf("Unknown opcode %d\n", instruction);
-        return offset + 1;
+        if (findSuperinstruction(instruction) != nullptr) { return superinstruction(name, chunk, offset, globals); }
+        if (instruction >= OP_R_ADD) { return registerInstruction(name, chunk, offset, globals); }
+        return simpleInstruction(name, offset);
     }
-    return 0;
+}
+
+void OpcodeStats::record(OpCode op)
+{
+    ++total;
+    ++singles[op];
+    if (historyLength >= 1) { ++pairs[(history & 0xff) << 8 | op]; }
+    if (historyLength >= 2) { ++triples[(history & 0xffff) << 8 | op]; }
+    history = history << 8 | op;
+    historyLength = std::min(historyLength + 1, 2);
+}
+
+// sequences are only counted within a line: a superinstruction reports its runtime errors against one line, so the
+// optimizer never fuses instructions from different lines
+void OpcodeStats::count(const Chunk &chunk)
+{
+    for (size_t offset = 0; offset < chunk.code.size();) {
+        OpCode op = static_cast<OpCode>(chunk.code[offset]);
+        if (offset > 0 && chunk.getLine(offset) != chunk.getLine(offset - 1)) { breakSequence(); }
+        record(op);
+        offset += 1 + operandSize(op);
+    }
+    breakSequence();
+}
+
+static void reportSequences(FILE *out, const char *title, const std::unordered_map<uint32_t, size_t> &counts, int length, size_t total,
+                            size_t limit)
+{
+    std::vector<std::pair<uint32_t, size_t>> sorted(counts.begin(), counts.end());
+    std::sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) { return a.second > b.second || (a.second == b.second && a.first < b.first); });
+    if (sorted.size() > limit) { sorted.resize(limit); }
+
+    fprintf(out, "%s:\n", title);
+    for (auto [key, count] : sorted) {
+        fprintf(out, "%12zu %6.2f%% ", count, 100.0 * count / total);
+        for (int i = length - 1; i >= 0; --i) { fprintf(out, " %s", opcodeName(static_cast<OpCode>(key >> (8 * i) & 0xff))); }
+        fprintf(out, "\n");
+    }
+}
+
+void OpcodeStats::report(FILE *out, size_t limit) const
+{
+    fprintf(out, "%zu instructions\n", total);
+    reportSequences(out, "opcodes", singles, 1, total, limit);
+    reportSequences(out, "pairs", pairs, 2, total, limit);
+    reportSequences(out, "triples", triples, 3, total, limit);
 }
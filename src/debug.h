@@ -1,19 +1,59 @@
 #ifndef CXXLOX_DEBUG_H
 #define CXXLOX_DEBUG_H
 
+#include <cstdio>
+#include <unordered_map>
+
 #include "chunk.h"
+#include "table.h"
 
 class Disassembler
 {
 public:
-    static void disassembleChunk(const Chunk &chunk, const char *name);
-    static int disassembleInstruction(const Chunk &chunk, int offset);
+    static void disassembleChunk(const Chunk &chunk, const char *name, const Globals &globals);
+    static int disassembleInstruction(const Chunk &chunk, int offset, const Globals &globals);
 
 private:
     static int constantInstruction(const char *name, const Chunk &chunk, int offset);
+    static int operandInstruction(const char *name, const Chunk &chunk, int offset);
+    static int globalInstruction(const char *name, const Chunk &chunk, int offset, const Globals &globals);
+    static int superinstruction(const char *name, const Chunk &chunk, int offset, const Globals &globals);
+    static int registerInstruction(const char *name, const Chunk &chunk, int offset, const Globals &globals);
 };
 
-static inline void disassembleChunk(const Chunk &chunk, const char *name) { Disassembler::disassembleChunk(chunk, name); }
-static inline int disassembleInstruction(const Chunk &chunk, int offset) { return Disassembler::disassembleInstruction(chunk, offset); }
+static inline void disassembleChunk(const Chunk &chunk, const char *name, const Globals &globals) { Disassembler::disassembleChunk(chunk, name, globals); }
+static inline int disassembleInstruction(const Chunk &chunk, int offset, const Globals &globals)
+{
+    return Disassembler::disassembleInstruction(chunk, offset, globals);
+}
 void printValue(Value value);
+
+// nullptr for a byte that is not an opcode
+const char *opcodeName(OpCode op);
+
+// How often each opcode, and each pair and triple of consecutive opcodes, occurs in the code it is shown; the data the
+// superinstructions in chunk.h are chosen from.
+class OpcodeStats
+{
+public:
+    void record(OpCode op);
+
+    // the next opcode recorded does not follow the previous one
+    void breakSequence() { historyLength = 0; }
+
+    // records every instruction of chunk
+    void count(const Chunk &chunk);
+
+    // prints the limit most frequent opcodes, pairs and triples
+    void report(FILE *out, size_t limit) const;
+
+private:
+    // sequences are keyed by their opcodes packed into the bytes of an integer, the first one in the highest byte
+    std::unordered_map<uint32_t, size_t> singles;
+    std::unordered_map<uint32_t, size_t> pairs;
+    std::unordered_map<uint32_t, size_t> triples;
+    size_t total = 0;
+    uint32_t history = 0;  // the last two opcodes recorded
+    int historyLength = 0;
+};
 #endif
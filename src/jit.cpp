@@ -0,0 +1,549 @@
+#include "jit.h"
+
+#include <cstdio>
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "debug.h"
+#include "object.h"
+#include "vm.h"
+
+JitCode::~JitCode()
+{
+    if (memory != nullptr) { munmap(memory, size); }
+}
+
+JitCompiler::~JitCompiler()
+{
+    if (code != nullptr) { munmap(code, capacity); }
+}
+
+#ifdef JIT_COMPILER
+
+namespace {
+
+// the opcodes, after the prefix and 0x0F, of the SSE2 instructions on doubles
+constexpr uint8_t MOVSD = 0x10;
+constexpr uint8_t UCOMISD = 0x2E;
+constexpr uint8_t ADDSD = 0x58;
+constexpr uint8_t MULSD = 0x59;
+constexpr uint8_t SUBSD = 0x5C;
+constexpr uint8_t DIVSD = 0x5E;
+
+// condition codes, as in jcc and setcc
+constexpr uint8_t CC_E = 0x4;
+constexpr uint8_t CC_NE = 0x5;
+constexpr uint8_t CC_BE = 0x6;
+constexpr uint8_t CC_A = 0x7;
+constexpr uint8_t CC_P = 0xA;
+constexpr uint8_t CC_NP = 0xB;
+
+// the pendingIndex of nil, true and false, which are made from QNAN rather than loaded
+constexpr uint32_t NOT_IN_POOL = UINT32_MAX;
+
+}  // namespace
+
+bool JitCompiler::compile(JitCode &result)
+{
+    // most instructions take a dozen bytes or two of machine code for each byte of bytecode
+    if (!map(16 * chunk.code.size() + MAX_SEQUENCE)) { return false; }
+    prologue();
+    for (size_t offset = 0; offset < chunk.code.size();) {
+        OpCode op = genericForm(static_cast<OpCode>(chunk.code[offset]));
+        makeRoom();
+        const Superinstruction *super = findSuperinstruction(op);
+        if (super == nullptr) {
+            int size = operandSize(op);
+            translate(op, size == 0 ? 0 : size == 1 ? chunk.code[offset + 1] : chunk.readOperand(offset), static_cast<uint32_t>(offset));
+            offset += 1 + size;
+            continue;
+        }
+        // the parts of a superinstruction one by one, each with its one byte operand; all of them report errors against
+        // the superinstruction
+        const uint8_t *operand = &chunk.code[offset + 1];
+        for (int i = 0; i != super->length; ++i) {
+            OpCode part = super->parts[i];
+            makeRoom();
+            translate(part, operandSize(part) != 0 ? *operand++ : 0, static_cast<uint32_t>(offset));
+        }
+        offset = operand - chunk.code.data();
+    }
+
+    // every slow path goes through the same call, with the index of its description in edx
+    makeRoom();
+    size_t handler = length;
+    registers(0x89, R12, RDI);  // mov rdi, r12
+    registers(0x89, RBX, RSI);  // mov rsi, rbx
+    moveImmediate(RCX, reinterpret_cast<uintptr_t>(&result));
+    moveImmediate(RAX, reinterpret_cast<uintptr_t>(&slowPath));
+    emit({0xFF, 0xD0});        // call rax
+    emit({0x48, 0x85, 0xC0});  // test rax, rax
+    errorJumps.push_back(jump(CC_E));
+    emit({0xFF, 0xE0});  // jmp rax
+    emitStubs(handler);
+
+    makeRoom();
+    size_t error = length;
+    emit({0x31, 0xC0});  // xor eax, eax
+    epilogue();
+    for (size_t jump : errorJumps) { patch(jump, error); }
+
+    if (failed) { return false; }
+    // the pages past the code go back, and the rest is never writable and executable at once
+    size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t size = (length + pageSize - 1) / pageSize * pageSize;
+    if (size < capacity) { munmap(code + size, capacity - size); }
+    capacity = size;
+    if (mprotect(code, size, PROT_READ | PROT_EXEC) != 0) { return false; }
+    result.memory = code;
+    result.size = size;
+    result.entry = reinterpret_cast<JitCode::Entry>(code);
+    result.slowPaths = std::move(slowPaths);
+    code = nullptr;
+    return true;
+}
+
+// the code is emitted straight into memory mapped for it, which only has to be made executable when it is done
+bool JitCompiler::map(size_t size)
+{
+    void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) { return false; }
+    madvise(memory, size, MADV_HUGEPAGE);
+    code = static_cast<uint8_t *>(memory);
+    capacity = size;
+    return true;
+}
+
+// offset is the instruction's, or that of the superinstruction it is part of, for reporting errors
+void JitCompiler::translate(OpCode op, uint32_t operand, uint32_t offset)
+{
+    int top = depth;
+    switch (op) {
+    case OP_ADD:
+    case OP_DIVIDE:
+    case OP_MULTIPLY:
+    case OP_SUBTRACT: {
+        // the runtime concatenates strings, and reports the error for anything else
+        bool constant = pendingNumber();
+        arithmetic(op == OP_ADD ? ADDSD : op == OP_DIVIDE ? DIVSD : op == OP_MULTIPLY ? MULSD : SUBSD);
+        addSlowPath(op, top, 0, offset, constant);
+        --depth;
+        break;
+    }
+    case OP_CONSTANT:
+    case OP_CONSTANT_LONG:
+        push(chunk.constants.values[operand], operand);
+        break;
+    case OP_DEFINE_GLOBAL:
+    case OP_DEFINE_GLOBAL_LONG:
+        if (pending) {
+            loadConstant(RAX, pendingValue, pendingIndex);
+            pending = false;
+        } else {
+            memory(0x8B, RAX, RBX, stackSlot(depth - 1));
+        }
+        memory(0x89, RAX, R13, 8 * operand);
+        --depth;
+        break;
+    case OP_EQUAL:
+    case OP_NOT_EQUAL: {
+        bool constant = pendingNumber();
+        equality(op == OP_NOT_EQUAL);
+        addSlowPath(op, top, 0, offset, constant);
+        --depth;
+        break;
+    }
+    case OP_FALSE:
+        push(FALSE_VAL, NOT_IN_POOL);
+        break;
+    case OP_GET_GLOBAL:
+    case OP_GET_GLOBAL_LONG:
+        flush();
+        memory(0x8B, RAX, R13, 8 * operand);
+        checkDefined();
+        memory(0x89, RAX, RBX, stackSlot(depth));
+        addSlowPath(OP_GET_GLOBAL, top, operand, offset, false);
+        ++depth;
+        break;
+    case OP_GREATER:
+    case OP_GREATER_EQUAL:
+    case OP_LESS:
+    case OP_LESS_EQUAL: {
+        // a > b and b > a; the others are their negations, !(a < b) and !(a > b) as the interpreter computes them,
+        // which are true if either is NaN
+        bool constant = pendingNumber();
+        comparison(op == OP_GREATER || op == OP_LESS ? CC_A : CC_BE, op == OP_LESS || op == OP_GREATER_EQUAL);
+        addSlowPath(op, top, 0, offset, constant);
+        --depth;
+        break;
+    }
+    case OP_IMPORT:
+    case OP_IMPORT_LONG:
+        flush();
+        callRuntime(reinterpret_cast<const void *>(&import), top, operand, offset);
+        emit({0x84, 0xC0});  // test al, al
+        errorJumps.push_back(jump(CC_E));
+        break;
+    case OP_NEGATE:
+        flush();
+        memory(0x8B, RAX, RBX, stackSlot(depth - 1));
+        checkNumber(RAX);
+        emit({0x48, 0x0F, 0xBA, 0xF8, 0x3F});  // btc rax, 63
+        memory(0x89, RAX, RBX, stackSlot(depth - 1));
+        addSlowPath(op, top, 0, offset, false);
+        break;
+    case OP_NIL:
+        push(NIL_VAL, NOT_IN_POOL);
+        break;
+    case OP_NOT:
+        flush();
+        // nil and false are the two values right after QNAN
+        memory(0x8B, RAX, RBX, stackSlot(depth - 1));
+        memory(0x8D, RCX, R14, TAG_NIL);
+        registers(0x29, RCX, RAX);                      // sub rax, rcx
+        emit({0x48, 0x83, 0xF8, TAG_FALSE - TAG_NIL});  // cmp rax, 1
+        set(CC_BE, RAX);
+        storeBool(depth - 1);
+        break;
+    case OP_POP:
+        // a constant never stored needs no discarding
+        pending = false;
+        --depth;
+        break;
+    case OP_PRINT:
+        flush();
+        callRuntime(reinterpret_cast<const void *>(&print), top);
+        --depth;
+        break;
+    case OP_RETURN:
+        flush();
+        memory(0x8D, RAX, RBX, stackSlot(depth));
+        epilogue();
+        break;
+    case OP_SET_GLOBAL:
+    case OP_SET_GLOBAL_LONG:
+        // the value stays on top of the stack, stored or not
+        memory(0x8B, RAX, R13, 8 * operand);
+        checkDefined();
+        if (pending) {
+            loadConstant(RAX, pendingValue, pendingIndex);
+        } else {
+            memory(0x8B, RAX, RBX, stackSlot(depth - 1));
+        }
+        memory(0x89, RAX, R13, 8 * operand);
+        addSlowPath(OP_SET_GLOBAL, top, operand, offset, pending);
+        break;
+    case OP_TRUE:
+        push(TRUE_VAL, NOT_IN_POOL);
+        break;
+    default:
+        // superinstructions are translated part by part, and register instructions never occur in stack code
+        break;
+    }
+}
+
+void JitCompiler::push(Value value, uint32_t index)
+{
+    flush();
+    pending = true;
+    pendingValue = value;
+    pendingIndex = index;
+    ++depth;
+}
+
+// stores the constant on top of the stack, if it is not yet
+void JitCompiler::flush()
+{
+    if (!pending) { return; }
+    loadConstant(RAX, pendingValue, pendingIndex);
+    memory(0x89, RAX, RBX, stackSlot(depth - 1));
+    pending = false;
+}
+
+void JitCompiler::loadConstant(Register reg, Value value, uint32_t index)
+{
+    if (index == NOT_IN_POOL) {
+        memory(0x8D, reg, R14, static_cast<int32_t>(value - QNAN));  // lea reg, [r14 + tag]
+    } else {
+        memory(0x8B, reg, R15, 8 * index);
+    }
+}
+
+// a into xmm0 and b into xmm1, jumping to the slow path unless both are numbers; a is loaded through rax, and b
+// through rcx unless it is a number constant, which is taken from the pool without being stored
+void JitCompiler::loadOperands()
+{
+    if (!pendingNumber()) { flush(); }
+    memory(0x8B, RAX, RBX, stackSlot(depth - 2));
+    checkNumber(RAX);
+    emit({0x66, 0x48, 0x0F, 0x6E, 0xC0});  // movq xmm0, rax
+    if (pending) {
+        memorySse(0xF2, MOVSD, 1, R15, 8 * pendingIndex);
+        pending = false;
+        return;
+    }
+    memory(0x8B, RCX, RBX, stackSlot(depth - 1));
+    checkNumber(RCX);
+    emit({0x66, 0x48, 0x0F, 0x6E, 0xC9});  // movq xmm1, rcx
+}
+
+void JitCompiler::checkNumber(Register value)
+{
+    registers(0x89, value, RDX);  // mov rdx, value
+    registers(0x21, R14, RDX);    // and rdx, r14
+    registers(0x39, R14, RDX);    // cmp rdx, r14
+    slowJumps[slowJumpCount++] = jump(CC_E);
+}
+
+// a op b for the two numbers on top of the stack, into the slot of a
+void JitCompiler::arithmetic(uint8_t operation)
+{
+    loadOperands();
+    emit({0xF2, 0x0F, operation, 0xC1});   // op xmm0, xmm1
+    emit({0x66, 0x48, 0x0F, 0x7E, 0xC0});  // movq rax, xmm0
+    memory(0x89, RAX, RBX, stackSlot(depth - 2));
+}
+
+// a > b, or b > a if swapped, for the two numbers on top of the stack, with condition CC_A, or its negation with CC_BE
+void JitCompiler::comparison(uint8_t condition, bool swapped)
+{
+    loadOperands();
+    emit({0x66, 0x0F, UCOMISD, static_cast<uint8_t>(swapped ? 0xC8 : 0xC1)});  // ucomisd xmm0, xmm1 or xmm1, xmm0
+    set(condition, RAX);
+    storeBool(depth - 2);
+}
+
+// numbers compare as doubles inline, everything else in the runtime, which flattens ropes
+void JitCompiler::equality(bool negated)
+{
+    loadOperands();
+    emit({0x66, 0x0F, UCOMISD, 0xC1});  // ucomisd xmm0, xmm1
+    // unordered, for NaN, sets the parity flag and compares unequal
+    if (negated) {
+        set(CC_NE, RAX);
+        set(CC_P, RCX);
+        emit({0x08, 0xC8});  // or al, cl
+    } else {
+        set(CC_E, RAX);
+        set(CC_NP, RCX);
+        emit({0x20, 0xC8});  // and al, cl
+    }
+    storeBool(depth - 2);
+}
+
+// TRUE_VAL and FALSE_VAL differ only in their lowest bit
+void JitCompiler::storeBool(int index)
+{
+    emit({0x0F, 0xB6, 0xC0});  // movzx eax, al
+    memory(0x8D, RCX, R14, TAG_FALSE);
+    registers(0x09, RCX, RAX);  // or rax, rcx
+    memory(0x89, RAX, RBX, stackSlot(index));
+}
+
+// jumps to the slow path if the global in rax is undefined
+void JitCompiler::checkDefined()
+{
+    memory(0x8D, RCX, R14, TAG_UNDEFINED);
+    registers(0x39, RCX, RAX);  // cmp rax, rcx
+    slowJumps[slowJumpCount++] = jump(CC_E);
+}
+
+// constant is whether the fast path took the constant on top of the stack from the pool, or left it there unstored
+void JitCompiler::addSlowPath(OpCode op, int top, uint32_t operand, uint32_t offset, bool constant)
+{
+    uint32_t index = static_cast<uint32_t>(slowPaths.size());
+    stubs.push_back(Stub{{slowJumps[0], slowJumps[1]}, slowJumpCount, index, constant, pendingValue, pendingIndex});
+    slowPaths.push_back(JitCode::SlowPath{op, top, operand, offset, static_cast<uint32_t>(length)});
+    slowJumpCount = 0;
+}
+
+// each stub stores the constant its fast path left unstored, so that the runtime finds the stack as the interpreter
+// would have it
+void JitCompiler::emitStubs(size_t handler)
+{
+    for (const Stub &stub : stubs) {
+        makeRoom();
+        for (int i = 0; i != stub.jumpCount; ++i) { patch(stub.jumps[i], length); }
+        if (stub.constant) {
+            loadConstant(RAX, stub.value, stub.constantIndex);
+            memory(0x89, RAX, RBX, stackSlot(slowPaths[stub.index].top - 1));
+        }
+        emit({0xBA});  // mov edx, index
+        emit32(stub.index);
+        patch(jump(), handler);
+    }
+}
+
+void JitCompiler::callRuntime(const void *function, int top, uint32_t a, uint32_t b)
+{
+    registers(0x89, R12, RDI);  // mov rdi, r12
+    memory(0x8D, RSI, RBX, stackSlot(top));
+    emit({0xBA});  // mov edx, a
+    emit32(a);
+    emit({0xB9});  // mov ecx, b
+    emit32(b);
+    moveImmediate(RAX, reinterpret_cast<uintptr_t>(function));
+    emit({0xFF, 0xD0});  // call rax
+}
+
+// rbx holds the stack top, r12 the VM, r13 the globals, r14 QNAN and r15 the constants; five pushes keep the stack
+// aligned for calls
+void JitCompiler::prologue()
+{
+    emit({0x53, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57});  // push rbx, r12, r13, r14, r15
+    registers(0x89, RDI, R12);                                     // mov r12, rdi
+    registers(0x89, RSI, RBX);                                     // mov rbx, rsi
+    moveImmediate(R13, reinterpret_cast<uintptr_t>(globalValues));
+    moveImmediate(R14, QNAN);
+    moveImmediate(R15, reinterpret_cast<uintptr_t>(chunk.constants.values.data()));
+}
+
+// returns rax
+void JitCompiler::epilogue() { emit({0x41, 0x5F, 0x41, 0x5E, 0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3}); }  // pop r15, r14, r13, r12, rbx; ret
+
+// remapping moves the pages rather than copying them; nothing in the code depends on where it is until it runs
+void JitCompiler::makeRoom()
+{
+    if (capacity - length >= MAX_SEQUENCE) { return; }
+    void *memory = mremap(code, capacity, 2 * capacity, MREMAP_MAYMOVE);
+    if (memory == MAP_FAILED) {
+        // the rest is emitted over what is there, and thrown away
+        failed = true;
+        length = 0;
+        return;
+    }
+    madvise(memory, 2 * capacity, MADV_HUGEPAGE);
+    code = static_cast<uint8_t *>(memory);
+    capacity *= 2;
+}
+
+void JitCompiler::emit32(uint32_t value)
+{
+    memcpy(&code[length], &value, 4);
+    length += 4;
+}
+
+void JitCompiler::moveImmediate(Register reg, uint64_t value)
+{
+    if (value <= UINT32_MAX) {
+        // mov r32, imm32, which clears the upper half
+        if (reg >= 8) { emit({0x41}); }
+        emit({static_cast<uint8_t>(0xB8 + (reg & 7))});
+        emit32(static_cast<uint32_t>(value));
+        return;
+    }
+    emit({static_cast<uint8_t>(reg >= 8 ? 0x49 : 0x48), static_cast<uint8_t>(0xB8 + (reg & 7))});
+    emit32(static_cast<uint32_t>(value));
+    emit32(static_cast<uint32_t>(value >> 32));
+}
+
+void JitCompiler::memory(uint8_t opcode, Register reg, Register base, int32_t displacement)
+{
+    bool shortDisplacement = displacement >= INT8_MIN && displacement <= INT8_MAX;
+    emit({static_cast<uint8_t>(0x48 | (reg >= 8) << 2 | (base >= 8)), opcode,
+          static_cast<uint8_t>((shortDisplacement ? 0x40 : 0x80) | (reg & 7) << 3 | (base & 7))});
+    if (shortDisplacement) {
+        emit({static_cast<uint8_t>(displacement)});
+    } else {
+        emit32(static_cast<uint32_t>(displacement));
+    }
+}
+
+void JitCompiler::memorySse(uint8_t prefix, uint8_t opcode, uint8_t xmm, Register base, int32_t displacement)
+{
+    bool shortDisplacement = displacement >= INT8_MIN && displacement <= INT8_MAX;
+    emit({prefix});
+    if (base >= 8) { emit({0x41}); }
+    emit({0x0F, opcode, static_cast<uint8_t>((shortDisplacement ? 0x40 : 0x80) | xmm << 3 | (base & 7))});
+    if (shortDisplacement) {
+        emit({static_cast<uint8_t>(displacement)});
+    } else {
+        emit32(static_cast<uint32_t>(displacement));
+    }
+}
+
+void JitCompiler::registers(uint8_t opcode, Register reg, Register rm)
+{
+    emit({static_cast<uint8_t>(0x48 | (reg >= 8) << 2 | (rm >= 8)), opcode, static_cast<uint8_t>(0xC0 | (reg & 7) << 3 | (rm & 7))});
+}
+
+// setcc into the low byte of reg, which is rax or rcx
+void JitCompiler::set(uint8_t condition, Register reg) { emit({0x0F, static_cast<uint8_t>(0x90 | condition), static_cast<uint8_t>(0xC0 | reg)}); }
+
+size_t JitCompiler::jump(uint8_t condition)
+{
+    emit({0x0F, static_cast<uint8_t>(0x80 | condition)});
+    emit32(0);
+    return length;
+}
+
+size_t JitCompiler::jump()
+{
+    emit({0xE9});
+    emit32(0);
+    return length;
+}
+
+void JitCompiler::patch(size_t jump, size_t target)
+{
+    uint32_t relative = static_cast<uint32_t>(static_cast<int32_t>(target - jump));
+    memcpy(&code[jump - 4], &relative, 4);
+}
+
+#else
+
+bool JitCompiler::compile(JitCode &) { return false; }
+
+#endif
+
+const uint8_t *JitCompiler::slowPath(VM *vm, Value *stackBase, uint32_t index, const JitCode *code)
+{
+    const JitCode::SlowPath &path = code->slowPaths[index];
+    Value *stackTop = stackBase + path.top;
+    const uint8_t *resume = static_cast<const uint8_t *>(code->memory) + path.resume;
+    vm->stackTop = stackTop;
+    // the instruction is the one executing, as far as runtimeError() is concerned
+    vm->ip = vm->chunk->code.data() + path.offset + 1;
+    switch (path.op) {
+    case OP_ADD:
+        if (IS_ANY_STRING(stackTop[-1]) && IS_ANY_STRING(stackTop[-2])) {
+            vm->concatenate();
+            return resume;
+        }
+        vm->runtimeError("Operand must be two numbers or two strings.");
+        return nullptr;
+    case OP_EQUAL:
+    case OP_NOT_EQUAL:
+        // comparing a rope flattens it, which allocates, so the operands stay on the stack until the result is known
+        stackTop[-2] = BOOL_VAL(valuesEqual(stackTop[-2], stackTop[-1]) == (path.op == OP_EQUAL));
+        return resume;
+    case OP_GET_GLOBAL:
+        vm->runtimeError("Undefined variable '%s'.", vm->globals.name(path.operand)->getChars());
+        return nullptr;
+    case OP_NEGATE:
+        vm->runtimeError("Operand must be a number.");
+        return nullptr;
+    case OP_SET_GLOBAL:
+        vm->runtimeError("Undefined varible: '%s'", vm->globals.name(path.operand)->getChars());
+        return nullptr;
+    default:
+        vm->runtimeError("Operands must be numbers.");
+        return nullptr;
+    }
+}
+
+void JitCompiler::print(VM *vm, Value *stackTop)
+{
+    vm->stackTop = stackTop;
+    printValue(stackTop[-1]);
+    printf("\n");
+}
+
+// the module runs as the interpreter would run it, compiled too; an error in it has already been reported
+bool JitCompiler::import(VM *vm, Value *stackTop, uint32_t module, uint32_t offset)
+{
+    vm->stackTop = stackTop;
+    vm->ip = vm->chunk->code.data() + offset + 1;
+    return vm->runModule<Untraced>(module) == INTERPRET_OK;
+}
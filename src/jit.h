@@ -0,0 +1,174 @@
+#ifndef CXXLOX_JIT_H
+#define CXXLOX_JIT_H
+
+#include <algorithm>
+#include <initializer_list>
+#include <vector>
+
+#include "chunk.h"
+
+class VM;
+
+// Machine code compiled from a chunk, in memory mapped for it. It runs the chunk with its stack starting at stackTop
+// and returns the top it leaves, or nullptr after a runtime error, which has already been reported.
+class JitCode
+{
+public:
+    JitCode() = default;
+    JitCode(const JitCode &) = delete;
+    JitCode &operator=(const JitCode &) = delete;
+    ~JitCode();
+
+    Value *run(VM &vm, Value *stackTop) const { return entry(&vm, stackTop); }
+
+private:
+    friend class JitCompiler;
+
+    using Entry = Value *(*) (VM *vm, Value *stackTop);
+
+    // what the runtime needs to know to take over an instruction from its fast path
+    struct SlowPath
+    {
+        OpCode op;
+        int top;           // the depth of the stack before the instruction
+        uint32_t operand;  // the global slot of OP_GET_GLOBAL and OP_SET_GLOBAL
+        uint32_t offset;   // of the instruction, or the superinstruction it is part of
+        uint32_t resume;   // where the code goes on if the runtime completes the instruction
+    };
+
+    void *memory = nullptr;
+    size_t size = 0;
+    Entry entry = nullptr;
+    std::vector<SlowPath> slowPaths;
+};
+
+// Compiles a chunk of stack code into x86-64 machine code for --jit: each instruction is replaced by a fixed sequence
+// of machine instructions, one after the other, with no dispatch left between them.
+//
+// The code is straight-line, so the depth of the stack before each instruction is known here, and the machine code
+// addresses every stack slot at a fixed offset from the stack top it was entered with rather than pushing and popping.
+// A constant is not stored to its slot until something needs it there; an operation on a number constant takes it from
+// the pool instead, without checking its type. Arithmetic and comparisons on numbers, the globals, nil, true, false
+// and ! run inline.
+//
+// Everything else calls back into the runtime: printing and importing directly, and adding strings, comparing other
+// values and every runtime error from a slow path, code after the last instruction that the fast path jumps to and
+// that hands the runtime a description of the instruction. The runtime reports errors with the messages and lines of
+// the interpreter by pointing the VM's ip at the instruction.
+//
+// Only Linux on x86-64 with NaN boxing has a code generator (see JIT_COMPILER); elsewhere compile() fails and the chunk
+// is interpreted.
+class JitCompiler
+{
+public:
+    // globalValues are the VM's, which no slots are added to while the code runs
+    JitCompiler(const Chunk &chunk, Value *globalValues) : chunk(chunk), globalValues(globalValues) {}
+    JitCompiler(const JitCompiler &) = delete;
+    JitCompiler &operator=(const JitCompiler &) = delete;
+    ~JitCompiler();
+
+    // false if the chunk cannot be compiled here, or no executable memory could be mapped
+    bool compile(JitCode &result);
+
+private:
+    enum Register : uint8_t
+    {
+        RAX = 0,
+        RCX = 1,
+        RDX = 2,
+        RBX = 3,  // the stack top the code was entered with
+        RSI = 6,
+        RDI = 7,
+        R12 = 12,  // the VM
+        R13 = 13,  // the globals
+        R14 = 14,  // QNAN, the tag bits of every value that is not a number
+        R15 = 15,  // the constants
+    };
+
+    // the jumps of an instruction's fast path to its slow path, which is emitted after the last instruction
+    struct Stub
+    {
+        size_t jumps[2];  // one for each operand checked
+        int jumpCount;
+        uint32_t index;  // of the slow path in JitCode::slowPaths
+        // the constant on top of the stack that the fast path took from the pool, if any, which the slow path stores
+        bool constant;
+        Value value;
+        uint32_t constantIndex;
+    };
+
+    const Chunk &chunk;
+    Value *globalValues;
+    // emitted up to length; the rest is room for the instruction being compiled, see makeRoom()
+    uint8_t *code = nullptr;
+    size_t capacity = 0;
+    size_t length = 0;
+    bool failed = false;  // no room could be made
+    int depth = 0;  // of the stack before the instruction being compiled
+    // whether the value on top of the stack is a constant not stored yet, constants[pendingIndex] or, if pendingIndex
+    // is NOT_IN_POOL, nil, true or false
+    bool pending = false;
+    Value pendingValue = NIL_VAL;
+    uint32_t pendingIndex = 0;
+    // of the instruction being compiled to its slow path
+    size_t slowJumps[2];
+    int slowJumpCount = 0;
+    std::vector<Stub> stubs;
+    std::vector<size_t> errorJumps;
+    std::vector<JitCode::SlowPath> slowPaths;
+
+    void translate(OpCode op, uint32_t operand, uint32_t offset);
+    void push(Value value, uint32_t index);
+    void flush();
+    void loadConstant(Register reg, Value value, uint32_t index);
+    bool pendingNumber() const { return pending && IS_NUMBER(pendingValue); }
+    void loadOperands();
+    void checkNumber(Register value);
+    void arithmetic(uint8_t operation);
+    void comparison(uint8_t condition, bool swapped);
+    void equality(bool negated);
+    // the value of the condition in al as a bool, into the stack slot at index
+    void storeBool(int index);
+    void checkDefined();
+    // the stack slot at index, counted from the stack top the code was entered with
+    int32_t stackSlot(int index) const { return 8 * index; }
+
+    // the slow path of the instruction just compiled, which slowJumps lead to; the code goes on at resume, where the
+    // fast path ends, if the runtime completes the instruction
+    void addSlowPath(OpCode op, int top, uint32_t operand, uint32_t offset, bool constant);
+    void emitStubs(size_t handler);
+    // calls function(vm, stackTop, a, b), with stackTop at the stack slot top
+    void callRuntime(const void *function, int top, uint32_t a = 0, uint32_t b = 0);
+    void prologue();
+    void epilogue();
+
+    // the machine code of a single instruction, stub or the code around them is never longer than this, so the emitters
+    // write without checking for room
+    static constexpr size_t MAX_SEQUENCE = 256;
+    bool map(size_t size);
+    void makeRoom();
+    void emit(std::initializer_list<uint8_t> bytes)
+    {
+        std::copy(bytes.begin(), bytes.end(), code + length);
+        length += bytes.size();
+    }
+    void emit32(uint32_t value);
+    void moveImmediate(Register reg, uint64_t value);
+    // an instruction with a register and a memory operand; base is never rsp or r12, which would need a SIB byte
+    void memory(uint8_t opcode, Register reg, Register base, int32_t displacement);
+    // the same for an SSE2 instruction on a double, with xmm as the register operand
+    void memorySse(uint8_t prefix, uint8_t opcode, uint8_t xmm, Register base, int32_t displacement);
+    // an instruction with two register operands
+    void registers(uint8_t opcode, Register reg, Register rm);
+    void set(uint8_t condition, Register reg);
+    // each returns the offset of the end of the jump, which patch() makes it relative to
+    size_t jump(uint8_t condition);
+    size_t jump();
+    void patch(size_t jump, size_t target);
+
+    // the runtime the code calls back into; slowPath() returns where to go on, or nullptr after a runtime error
+    static const uint8_t *slowPath(VM *vm, Value *stackBase, uint32_t index, const JitCode *code);
+    static void print(VM *vm, Value *stackTop);
+    static bool import(VM *vm, Value *stackTop, uint32_t module, uint32_t offset);
+};
+#endif
@@ -1,17 +1,16 @@
-#include <filesystem>
-#include <fstream>
 #include <iostream>
-#include <new>
 #include <string>
+#include <string_view>
 
+#include "cache.h"
 #include "chunk.h"
 #include "common.h"
 #include "debug.h"
+#include "source.h"
+#include "transpiler.h"
 #include "vm.h"
 
-VM vm;
-
-static void repl()
+static void repl(VM &vm)
 {
     std::string line;
     line.reserve(1024);
@@ -26,52 +25,105 @@ static void repl()
     }
 }
 
-static std::string readFile(const char *path)
+// returns the exit status; with emitCpp, the script is translated to C++ on stdout rather than run
+static int runFile(VM &vm, const char *path, bool useCache, bool compileOnly, bool emitCpp)
 {
-    std::ifstream file(path);
-    if (!file) {
+    SourceFile file;
+    if (!file.open(path)) {
         fprintf(stderr, "Could not open file \"%s\".\n", path);
-        exit(74);
+        return 74;
     }
+    std::string_view source = file.text();
 
-    auto fileSize = std::filesystem::file_size(path);
-    std::string buffer;
-    try {
-        buffer.resize(fileSize + static_cast<std::ifstream::pos_type>(1), '\0');
-    } catch (std::bad_alloc &e) {
-        fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
-        exit(74);
+    Chunk chunk;
+    std::string cachePath = BytecodeCache::pathFor(path);
+    if (!useCache || !BytecodeCache::load(vm, cachePath, source, chunk)) {
+        if (!vm.compile(source, chunk, path)) { return 65; }
+        // the cache holds a single chunk, and would go stale with the modules anyway
+        if ((useCache || compileOnly) && !vm.importsModules()) { BytecodeCache::store(vm, cachePath, source, chunk); }
     }
-
-    try {
-        buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
-        file.read(&buffer[0], fileSize);
-    } catch (std::exception &e) {
-        fprintf(stderr, "Could not open file \"%s\".\n", path);
-        exit(74);
+    if (compileOnly) { return 0; }
+    if (emitCpp) {
+        Transpiler(vm, chunk).emit(stdout);
+        return 0;
     }
-    return buffer;
+
+    InterpretResult result = vm.execute(chunk);
+
+    if (result == INTERPRET_COMPILE_ERROR) { return 65; }
+    if (result == INTERPRET_RUNTIME_ERROR) { return 70; }
+    return 0;
 }
 
-static void runFile(const char *path)
+static void reportGCStats(const VM &vm)
 {
-    std::string source = readFile(path);
-    InterpretResult result = vm.interpret(source);
+    const GCStats &stats = vm.getGCStats();
+    fprintf(stderr, "gc: %zu collections, %zu bytes freed, %.3f ms total pause, %.3f ms max pause\n", stats.collections, stats.bytesFreed,
+            std::chrono::duration<double, std::milli>(stats.totalPause).count(), std::chrono::duration<double, std::milli>(stats.maxPause).count());
+}
 
-    if (result == INTERPRET_COMPILE_ERROR) { exit(65); }
-    if (result == INTERPRET_RUNTIME_ERROR) { exit(70); }
+static void usage()
+{
+    std::cerr << "Usage: cxxlox [--trace] [--dump-bytecode] [-O0|-O1|-O2]"
+              << " [--gc-stats] [--opcode-stats] [--profile-opcodes]"
+              << " [--register-vm] [--jit] [--no-quicken] [--no-cache]"
+              << " [--compile-only] [--emit-cpp] [path]" << std::endl;
+    exit(64);
 }
 
 int main(int argc, const char *argv[])
 {
-    if (argc == 1) {
-        repl();
-    } else if (argc == 2) {
-        runFile(argv[1]);
+    InterpretOptions options;
+    OpcodeStats opcodeStats;
+    bool printGCStats = false;
+    bool useCache = true;
+    bool compileOnly = false;
+    bool emitCpp = false;
+    const char *path = nullptr;
+    for (int i = 1; i != argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg == "--trace") {
+            options.traceExecution = true;
+        } else if (arg == "--dump-bytecode") {
+            options.printCode = true;
+        } else if (arg == "-O0" || arg == "-O1" || arg == "-O2") {
+            options.optimizationLevel = arg[2] - '0';
+        } else if (arg == "--gc-stats") {
+            printGCStats = true;
+        } else if (arg == "--opcode-stats") {
+            options.opcodeStats = &opcodeStats;
+        } else if (arg == "--profile-opcodes") {
+            options.profileOpcodes = true;
+        } else if (arg == "--register-vm") {
+            options.registerMachine = true;
+        } else if (arg == "--jit") {
+            options.jit = true;
+        } else if (arg == "--no-quicken") {
+            options.quicken = false;
+        } else if (arg == "--no-cache") {
+            useCache = false;
+        } else if (arg == "--compile-only") {
+            compileOnly = true;
+        } else if (arg == "--emit-cpp") {
+            emitCpp = true;
+        } else if (arg.starts_with("-") || path != nullptr) {
+            usage();
+        } else {
+            path = argv[i];
+        }
+    }
+    if ((compileOnly || emitCpp) && path == nullptr) { usage(); }
+
+    VM vm(options);
+    int status = 0;
+    if (path == nullptr) {
+        repl(vm);
     } else {
-        std::cerr << "Usage: clox [path]" << std::endl;
-        exit(64);
+        status = runFile(vm, path, useCache, compileOnly, emitCpp);
     }
 
-    return 0;
+    if (printGCStats) { reportGCStats(vm); }
+    if (options.opcodeStats != nullptr) { opcodeStats.report(stderr, 20); }
+    if (options.profileOpcodes) { vm.getProfiler().report(stderr, 20); }
+    return status;
 }
@@ -1,15 +1,215 @@
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
+#include <cstring>
 
 #include "memory.h"
+#include "vm.h"
 
-void *reallocate(void *pointer, size_t oldSize, size_t newSize)
+void *reallocate(VM &vm, void *pointer, size_t oldSize, size_t newSize)
+{
+    vm.bytesAllocated += newSize - oldSize;
+    if (newSize > oldSize) {
+#ifdef DEBUG_STRESS_GC
+        vm.collectGarbage();
+#endif
+        if (vm.bytesAllocated > vm.nextGC) { vm.collectGarbage(); }
+    }
+
+    return vm.allocator.reallocate(pointer, oldSize, newSize);
+}
+
+Allocator::~Allocator()
+{
+    for (void *slab : slabs) { free(slab); }
+    while (largeBlocks != nullptr) {
+        LargeBlock *next = largeBlocks->next;
+        free(largeBlocks);
+        largeBlocks = next;
+    }
+}
+
+void *Allocator::allocate(size_t size)
+{
+    if (size > MAX_SMALL) { return allocateLarge(size); }
+    return allocateSmall(sizeClass(size));
+}
+
+void Allocator::deallocate(void *pointer, size_t size)
+{
+    if (pointer == nullptr) { return; }
+    if (size > MAX_SMALL) {
+        deallocateLarge(pointer);
+        return;
+    }
+    FreeBlock *block = static_cast<FreeBlock *>(pointer);
+    size_t index = sizeClass(size);
+    block->next = freeLists[index];
+    freeLists[index] = block;
+}
+
+void *Allocator::reallocate(void *pointer, size_t oldSize, size_t newSize)
 {
     if (newSize == 0) {
-        free(pointer);
+        deallocate(pointer, oldSize);
         return nullptr;
     }
+    if (pointer == nullptr) { return allocate(newSize); }
 
-    void *result = realloc(pointer, newSize);
-    if (!result) { exit(1); }
+    if (oldSize <= MAX_SMALL && newSize <= MAX_SMALL && sizeClass(oldSize) == sizeClass(newSize)) { return pointer; }
+    if (oldSize > MAX_SMALL && newSize > MAX_SMALL) {
+        LargeBlock *block = static_cast<LargeBlock *>(pointer) - 1;
+        LargeBlock *prev = block->prev, *next = block->next;
+        block = static_cast<LargeBlock *>(realloc(block, sizeof(LargeBlock) + newSize));
+        if (block == nullptr) { exit(1); }
+        (prev != nullptr ? prev->next : largeBlocks) = block;
+        if (next != nullptr) { next->prev = block; }
+        return block + 1;
+    }
+
+    void *result = allocate(newSize);
+    memcpy(result, pointer, std::min(oldSize, newSize));
+    deallocate(pointer, oldSize);
+    return result;
+}
+
+void *Allocator::allocateSmall(size_t sizeClass)
+{
+    if (FreeBlock *block = freeLists[sizeClass]) {
+        freeLists[sizeClass] = block->next;
+        return block;
+    }
+
+    size_t size = (sizeClass + 1) * GRANULE;
+    if (static_cast<size_t>(bumpEnd - bump) < size) {
+        // whatever is left of the old slab is smaller than this block and simply abandoned
+        bump = static_cast<char *>(malloc(SLAB_SIZE));
+        if (bump == nullptr) { exit(1); }
+        slabs.push_back(bump);
+        bumpEnd = bump + SLAB_SIZE;
+    }
+    void *result = bump;
+    bump += size;
     return result;
 }
+
+void *Allocator::allocateLarge(size_t size)
+{
+    LargeBlock *block = static_cast<LargeBlock *>(malloc(sizeof(LargeBlock) + size));
+    if (block == nullptr) { exit(1); }
+    block->prev = nullptr;
+    block->next = largeBlocks;
+    if (largeBlocks != nullptr) { largeBlocks->prev = block; }
+    largeBlocks = block;
+    return block + 1;
+}
+
+void Allocator::deallocateLarge(void *pointer)
+{
+    LargeBlock *block = static_cast<LargeBlock *>(pointer) - 1;
+    (block->prev != nullptr ? block->prev->next : largeBlocks) = block->next;
+    if (block->next != nullptr) { block->next->prev = block->prev; }
+    free(block);
+}
+
+void VM::collectGarbage()
+{
+    auto start = std::chrono::steady_clock::now();
+    size_t before = bytesAllocated;
+
+    markRoots();
+    traceReferences();
+    strings.removeUnmarked();
+    sweep();
+
+    nextGC = std::max<size_t>(bytesAllocated * GC_HEAP_GROW_FACTOR, GC_MIN_HEAP);
+
+    auto pause = std::chrono::steady_clock::now() - start;
+    ++gcStats.collections;
+    gcStats.bytesFreed += before - bytesAllocated;
+    gcStats.totalPause += pause;
+    gcStats.maxPause = std::max(gcStats.maxPause, std::chrono::duration_cast<std::chrono::nanoseconds>(pause));
+}
+
+void VM::markValue(Value value)
+{
+    if (IS_OBJ(value)) { markObject(AS_OBJ(value)); }
+}
+
+void VM::markObject(Obj *object)
+{
+    if (object == nullptr || object->marked) { return; }
+    object->marked = true;
+    grayStack.push_back(object);
+}
+
+void VM::markRoots()
+{
+    for (Value *slot = stack; slot < stackTop; ++slot) { markValue(*slot); }
+
+    for (ObjString *name : globals.names) { markObject(name); }
+    for (Value value : globals.slotValues) { markValue(value); }
+
+    // the chunks being compiled or run; the compiler only adds a constant after creating its object, so this also
+    // covers every constant compiled so far
+    for (const ChunkScope *scope = scopes; scope != nullptr; scope = scope->outer) {
+        for (Value value : scope->chunk->constants.values) { markValue(value); }
+    }
+    for (const Module &module : modules) {
+        for (Value value : module.chunk.constants.values) { markValue(value); }
+    }
+}
+
+void VM::traceReferences()
+{
+    while (!grayStack.empty()) {
+        Obj *object = grayStack.back();
+        grayStack.pop_back();
+        blackenObject(object);
+    }
+}
+
+void VM::blackenObject(Obj *object)
+{
+    switch (object->type) {
+    case OBJ_ROPE: {
+        ObjRope *rope = static_cast<ObjRope *>(object);
+        markObject(rope->left);
+        markObject(rope->right);
+        markObject(rope->flat);
+        break;
+    }
+    case OBJ_STRING:
+        break;
+    }
+}
+
+void VM::sweep()
+{
+    Obj *previous = nullptr;
+    Obj *object = objects;
+    while (object != nullptr) {
+        if (object->marked) {
+            object->marked = false;
+            previous = object;
+            object = object->next;
+        } else {
+            Obj *unreached = object;
+            object = object->next;
+            if (previous != nullptr) {
+                previous->next = object;
+            } else {
+                objects = object;
+            }
+            freeObject(unreached);
+        }
+    }
+}
+
+void VM::freeObject(Obj *object)
+{
+    // objects may own trailing storage beyond sizeof their class, so the object reports its own size before being destroyed
+    size_t size = object->allocationSize();
+    object->~Obj();
+    reallocate(*this, object, size, 0);
+}
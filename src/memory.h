@@ -1,18 +1,73 @@
 #ifndef CXXLOX_MEMORY_H
 #define CXXLOX_MEMORY_H
 
+#include <vector>
+
 #include "common.h"
 #include "object.h"
 
-#define ALLOCATE(type, count) (type *) reallocate(NULL, 0, sizeof(type) * (count))
+#define ALLOCATE(vm, type, count) (type *) reallocate(vm, NULL, 0, sizeof(type) * (count))
 
-#define FREE(type, pointer) reallocate(pointer, sizeof(type), 0)
+#define FREE(vm, type, pointer) reallocate(vm, pointer, sizeof(type), 0)
 
 #define GROW_CAPACITY(capacity) ((capacity) < 8 ? 8 : (capacity) *2)
 
-#define FREE_ARRAY(type, pointer, oldCount) reallocate(pointer, sizeof(type) * (oldCount), 0)
+#define FREE_ARRAY(vm, type, pointer, oldCount) reallocate(vm, pointer, sizeof(type) * (oldCount), 0)
+
+#define GROW_ARRAY(vm, type, pointer, oldCount, newCount) (type *) reallocate(vm, pointer, sizeof(type) * (oldCount), sizeof(type) * newCount)
+
+#define GC_HEAP_GROW_FACTOR 2
+// keeps a nearly empty heap from being collected every few allocations
+#define GC_MIN_HEAP (1024 * 1024)
+
+class VM;
+
+// allocates, grows or frees (newSize 0) a block of vm's heap, collecting vm's garbage first when the heap has grown enough
+void *reallocate(VM &vm, void *pointer, size_t oldSize, size_t newSize);
+
+// Per-VM heap behind reallocate(). Blocks of up to MAX_SMALL bytes are rounded up to a size class, bump-allocated
+// out of shared slabs and recycled through one free list per class; larger blocks come from malloc. Everything is
+// released in bulk when the allocator is destroyed, so the VM never has to free its objects one by one.
+class Allocator
+{
+public:
+    Allocator() = default;
+    Allocator(const Allocator &) = delete;
+    Allocator &operator=(const Allocator &) = delete;
+    ~Allocator();
+
+    void *allocate(size_t size);
+    void deallocate(void *pointer, size_t size);
+    void *reallocate(void *pointer, size_t oldSize, size_t newSize);
+
+private:
+    static constexpr size_t GRANULE = 16;
+    static constexpr size_t MAX_SMALL = 256;
+    static constexpr size_t CLASS_COUNT = MAX_SMALL / GRANULE;
+    static constexpr size_t SLAB_SIZE = 64 * 1024;
+
+    struct FreeBlock
+    {
+        FreeBlock *next;
+    };
+
+    // prepended to every large block so that they can be unlinked one by one and released together
+    struct alignas(GRANULE) LargeBlock
+    {
+        LargeBlock *prev;
+        LargeBlock *next;
+    };
+
+    FreeBlock *freeLists[CLASS_COUNT] = {};
+    char *bump = nullptr;
+    char *bumpEnd = nullptr;
+    std::vector<void *> slabs;
+    LargeBlock *largeBlocks = nullptr;
 
-#define GROW_ARRAY(type, pointer, oldCount, newCount) (type *) reallocate(pointer, sizeof(type) * (oldCount), sizeof(type) * newCount)
+    static size_t sizeClass(size_t size) { return (size - 1) / GRANULE; }
 
-void *reallocate(void *pointer, size_t oldSize, size_t newSize);
+    void *allocateSmall(size_t sizeClass);
+    void *allocateLarge(size_t size);
+    void deallocateLarge(void *pointer);
+};
 #endif
@@ -0,0 +1,232 @@
+#include "module.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+
+#include "compiler.h"
+#include "debug.h"
+#include "object.h"
+#include "source.h"
+
+ModuleLoader::~ModuleLoader()
+{
+    {
+        std::lock_guard lock(mutex);
+        stopping = true;
+    }
+    queued.notify_all();
+    for (std::thread &worker : workers) { worker.join(); }
+}
+
+uint32_t ModuleLoader::request(std::string_view directory, std::string_view path, int optimizationLevel)
+{
+    std::filesystem::path resolved = (std::filesystem::path(directory) / path).lexically_normal();
+    // the same file imported along different paths is one module
+    std::error_code error;
+    std::filesystem::path canonical = std::filesystem::weakly_canonical(resolved, error);
+    std::string key = error ? resolved.string() : canonical.string();
+
+    std::lock_guard lock(mutex);
+    auto [index, inserted] = indices.try_emplace(key, static_cast<uint32_t>(jobs.size()));
+    if (!inserted) { return index->second; }
+
+    jobs.push_back(std::make_unique<Job>(Job{resolved.string(), key, optimizationLevel}));
+    queue.push_back(jobs.back().get());
+    ++pending;
+    if (workers.empty()) {
+        unsigned count = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned i = 0; i != count; ++i) { workers.emplace_back(&ModuleLoader::work, this); }
+    }
+    queued.notify_one();
+    return index->second;
+}
+
+void ModuleLoader::work()
+{
+    std::unique_lock lock(mutex);
+    for (;;) {
+        queued.wait(lock, [this] { return stopping || !queue.empty(); });
+        if (queue.empty()) { return; }
+        Job *job = queue.front();
+        queue.pop_front();
+
+        lock.unlock();
+        compile(*job);
+        lock.lock();
+        job->done = true;
+        --pending;
+        finished.notify_all();
+    }
+}
+
+// runs on a worker; only the printing options that would interleave with other workers are left out, the main thread
+// applies them when it links the chunk
+void ModuleLoader::compile(Job &job)
+{
+    InterpretOptions options;
+    options.optimizationLevel = job.optimizationLevel;
+    job.vm = std::make_unique<VM>(options);
+
+    char *errors = nullptr;
+    size_t errorsSize = 0;
+    FILE *out = open_memstream(&errors, &errorsSize);
+    fprintf(out, "In module \"%s\":\n", job.path.c_str());
+    SourceFile file;
+    if (!file.open(job.path.c_str())) {
+        fprintf(out, "Could not open file \"%s\".\n", job.path.c_str());
+    } else {
+        VM::ChunkScope scope(*job.vm, &job.chunk);
+        Compiler compiler(*job.vm, options, *this, std::filesystem::path(job.path).parent_path().string(), out);
+        job.compiled = compiler.compile(file.text(), job.chunk);
+    }
+    fclose(out);
+    job.errors.assign(errors, errorsSize);
+    free(errors);
+}
+
+// links each module as soon as it and those requested before it are compiled, while the workers go on with the rest
+bool ModuleLoader::link(VM &vm)
+{
+    bool linkedAll = true;
+    const InterpretOptions &options = vm.getOptions();
+    size_t first = linked;
+    for (;; ++linked) {
+        Job *next;
+        {
+            std::unique_lock lock(mutex);
+            // a module still being compiled may request more, so all are linked only once nothing is pending
+            finished.wait(lock, [this] { return linked != jobs.size() ? jobs[linked]->done : pending == 0; });
+            if (linked == jobs.size()) { break; }
+            next = jobs[linked].get();
+        }
+        Job &job = *next;
+        // every module gets its entry, so that the index of the next one is still the operand of its imports
+        Module &module = vm.modules.emplace_back(job.path);
+        if (!job.compiled) {
+            fputs(job.errors.c_str(), stderr);
+            linkedAll = false;
+        } else {
+            relocate(vm, job, module.chunk);
+            if (options.opcodeStats != nullptr) { options.opcodeStats->count(module.chunk); }
+            if (options.printCode) { disassembleChunk(module.chunk, module.path.c_str(), vm.getGlobals()); }
+        }
+        job.chunk = Chunk();
+        job.vm.reset();
+    }
+
+    // a module that compiled may still import one that did not, so every module of this link goes; their entries in
+    // vm stay, so that the indices of later modules still match
+    if (!linkedAll) {
+        std::lock_guard lock(mutex);
+        for (size_t i = first; i != linked; ++i) { indices.erase(jobs[i]->key); }
+    }
+    return linkedAll;
+}
+
+// what relocate() needs to know of every instruction, looked up once rather than for each
+struct OpcodeInfo
+{
+    const Superinstruction *super;
+    int operandSize;
+};
+
+static const std::array<OpcodeInfo, 256> &opcodeInfo()
+{
+    static const std::array<OpcodeInfo, 256> table = [] {
+        std::array<OpcodeInfo, 256> table;
+        for (int op = 0; op != 256; ++op) { table[op] = OpcodeInfo{findSuperinstruction(static_cast<OpCode>(op)), operandSize(static_cast<OpCode>(op))}; }
+        return table;
+    }();
+    return table;
+}
+
+// Copies the module's chunk into chunk, which vm keeps as a root. Constants and slots are translated once each up
+// front. An instruction whose operand does not change is copied as it is; superinstructions keep their short operands
+// when the translated ones still fit, and are split back into their parts when they do not.
+void ModuleLoader::relocate(VM &vm, const Job &job, Chunk &chunk)
+{
+    const Chunk &code = job.chunk;
+    const Globals &moduleGlobals = job.vm->getGlobals();
+
+    std::vector<uint32_t> slots(moduleGlobals.count());
+    for (int slot = 0; slot != moduleGlobals.count(); ++slot) {
+        ObjString *name = moduleGlobals.name(slot);
+        slots[slot] = vm.getGlobals().slot(copyString(vm, name->getChars(), name->getLength()));
+    }
+    // the module's pool has no duplicates, and neither has its copy, so every constant keeps its index; the copy is
+    // never added to, so it is not indexed for addConstant()
+    std::vector<Value> &constants = chunk.constants.values;
+    constants.reserve(code.constants.values.size());
+    for (Value value : code.constants.values) {
+        // only flat strings are ever constants; each is added to the pool as soon as it is made, which roots it
+        if (IS_OBJ(value)) { value = OBJ_VAL(copyString(vm, AS_STRING(value)->getChars(), AS_STRING(value)->getLength())); }
+        constants.push_back(value);
+    }
+
+    const std::array<OpcodeInfo, 256> &info = opcodeInfo();
+    chunk.code.reserve(code.code.size());
+    chunk.lines.reserve(code.lines.size());
+    size_t lineRun = 0;
+    for (size_t offset = 0; offset < code.code.size();) {
+        OpCode op = static_cast<OpCode>(code.code[offset]);
+        while (lineRun + 1 < code.lines.size() && code.lines[lineRun + 1].offset <= offset) { ++lineRun; }
+        unsigned line = code.lines[lineRun].line;
+        switch (op) {
+        case OP_DEFINE_GLOBAL:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+            chunk.writeOperand(op, slots[code.code[offset + 1]], line);
+            offset += 2;
+            continue;
+        case OP_DEFINE_GLOBAL_LONG:
+        case OP_GET_GLOBAL_LONG:
+        case OP_SET_GLOBAL_LONG: {
+            // the long form holds any slot
+            uint32_t slot = slots[code.readOperand(offset)];
+            chunk.write(op, line);
+            chunk.write(static_cast<uint8_t>(slot), line);
+            chunk.write(static_cast<uint8_t>(slot >> 8), line);
+            chunk.write(static_cast<uint8_t>(slot >> 16), line);
+            offset += 4;
+            continue;
+        }
+        default:
+            break;
+        }
+
+        const Superinstruction *super = info[op].super;
+        if (super == nullptr) {
+            // constants keep their index, and modules are numbered by this loader rather than by the VM compiling
+            // them, so OP_CONSTANT and OP_IMPORT are copied as they are too
+            size_t end = offset + 1 + info[op].operandSize;
+            for (; offset != end; ++offset) { chunk.write(code.code[offset], line); }
+            continue;
+        }
+        uint32_t operands[3];
+        const uint8_t *operand = &code.code[offset + 1];
+        bool fits = true;
+        for (int i = 0; i != super->length; ++i) {
+            if (info[super->parts[i]].operandSize == 0) { continue; }
+            operands[i] = super->parts[i] == OP_CONSTANT ? *operand++ : slots[*operand++];
+            fits = fits && operands[i] <= MAX_SHORT_OPERAND;
+        }
+        if (fits) {
+            chunk.write(op, line);
+            for (int i = 0; i != super->length; ++i) {
+                if (info[super->parts[i]].operandSize != 0) { chunk.write(static_cast<uint8_t>(operands[i]), line); }
+            }
+        } else {
+            for (int i = 0; i != super->length; ++i) {
+                if (info[super->parts[i]].operandSize == 0) {
+                    chunk.write(super->parts[i], line);
+                } else {
+                    chunk.writeOperand(super->parts[i], operands[i], line);
+                }
+            }
+        }
+        offset = operand - code.code.data();
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef CXXLOX_MODULE_H
+#define CXXLOX_MODULE_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "chunk.h"
+#include "vm.h"
+
+// Compiles the modules a script imports with `import "path";` on a pool of worker threads. The compiler requests a
+// module as soon as it parses the import, so the module is scanned and compiled while the rest of the importing file
+// is, and the imports of a module are requested the same way by the worker compiling it.
+//
+// VMs share nothing, so every module is compiled into a chunk of its own by a VM of its own. Linking is all that is
+// left for the importing VM's thread: it waits for the workers and copies each chunk into that VM, interning its
+// strings there and renumbering its global slots by name.
+class ModuleLoader
+{
+public:
+    ModuleLoader() = default;
+    ModuleLoader(const ModuleLoader &) = delete;
+    ModuleLoader &operator=(const ModuleLoader &) = delete;
+    ~ModuleLoader();
+
+    // the index of the module at path, which is relative to directory; a module not requested before is queued to be
+    // compiled at optimizationLevel. Called by the compilers of the script and of the modules, from any thread.
+    uint32_t request(std::string_view directory, std::string_view path, int optimizationLevel);
+
+    // links every module requested so far and not linked yet into vm, in the order they were requested, waiting for
+    // the workers to compile them; returns false, after printing their errors, if any of them failed to compile. Then
+    // the code that imports them never runs, and they are all forgotten, so that importing them again, on a later
+    // line of the REPL, compiles them again rather than running the empty entry of a module that failed
+    bool link(VM &vm);
+
+private:
+    struct Job
+    {
+        std::string path;
+        std::string key;  // in indices
+        int optimizationLevel;
+        std::unique_ptr<VM> vm;  // owns the objects the chunk refers to until it is linked
+        Chunk chunk;
+        std::string errors;  // printed when the module is linked, so that they do not interleave
+        bool compiled = false;
+        bool done = false;  // by a worker; guarded by the mutex
+    };
+
+    std::mutex mutex;
+    std::condition_variable queued;    // a job was queued, or the workers are stopping
+    std::condition_variable finished;  // a job is done
+    std::vector<std::unique_ptr<Job>> jobs;  // indexed by module
+    std::unordered_map<std::string, uint32_t> indices;
+    std::deque<Job *> queue;
+    size_t pending = 0;  // queued or being compiled
+    size_t linked = 0;
+    bool stopping = false;
+    // started by the first request
+    std::vector<std::thread> workers;
+
+    void work();
+    void compile(Job &job);
+    void relocate(VM &vm, const Job &job, Chunk &chunk);
+};
+#endif
@@ -0,0 +1,109 @@
+#include "native.h"
+
+#include <cstring>
+#include <string>
+
+#include "debug.h"
+
+int NativeRuntime::main(const NativeProgram &program)
+{
+    NativeRuntime runtime(program);
+    VM::ChunkScope scope(runtime.vm, &runtime.pool);
+    runtime.load();
+    return runtime.run(0, runtime.vm.stack) ? 0 : 70;
+}
+
+// the slots come back in the same order, so they get the numbers the generated code has for them
+void NativeRuntime::load()
+{
+    for (size_t i = 0; i != program.globalCount; ++i) {
+        const char *name = program.globals[i];
+        vm.globals.slot(copyString(vm, name, static_cast<int>(strlen(name))));
+    }
+
+    for (size_t i = 0; i != program.chunkCount; ++i) {
+        const NativeChunk &chunk = program.chunks[i];
+        constantOffsets.push_back(pool.constants.values.size());
+        for (size_t j = 0; j != chunk.constantCount; ++j) {
+            const NativeConstant &constant = chunk.constants[j];
+            switch (constant.kind) {
+            case NativeConstant::NUMBER:
+                pool.constants.write(NUMBER_VAL(std::bit_cast<double>(constant.bits)));
+                break;
+            case NativeConstant::STRING:
+                // stored before anything else is allocated, which makes it a root
+                pool.constants.write(OBJ_VAL(copyString(vm, constant.chars, constant.length)));
+                break;
+            case NativeConstant::NIL:
+                pool.constants.write(NIL_VAL);
+                break;
+            case NativeConstant::FALSE:
+                pool.constants.write(BOOL_VAL(false));
+                break;
+            case NativeConstant::TRUE:
+                pool.constants.write(BOOL_VAL(true));
+                break;
+            }
+        }
+    }
+    imported.assign(program.chunkCount, false);
+}
+
+// the chunk leaves the stack as it found it
+bool NativeRuntime::run(size_t chunk, Value *stack)
+{
+    if (!program.chunks[chunk].run(*this, stack)) { return false; }
+    vm.stackTop = stack;
+    return true;
+}
+
+bool NativeRuntime::add(Value *top, unsigned line)
+{
+    if (!IS_ANY_STRING(top[-1]) || !IS_ANY_STRING(top[-2])) { return error(line, "Operand must be two numbers or two strings."); }
+    vm.stackTop = top;
+    vm.concatenate();
+    return true;
+}
+
+void NativeRuntime::print(Value *top)
+{
+    vm.stackTop = top;
+    printValue(top[-1]);
+    printf("\n");
+}
+
+// modules are numbered from 1 in NativeProgram::chunks, after the script; marked before it runs, so that modules
+// importing each other do not import each other forever
+bool NativeRuntime::import(uint32_t module, Value *top)
+{
+    size_t chunk = module + 1;
+    if (imported[chunk]) { return true; }
+    imported[chunk] = true;
+
+    const char *importer = runningPath;
+    runningPath = program.chunks[chunk].path;
+    vm.stackTop = top;
+    bool result = run(chunk, top);
+    runningPath = importer;
+    return result;
+}
+
+bool NativeRuntime::error(unsigned line, const char *message)
+{
+    fprintf(stderr, "%s\n", message);
+    fprintf(stderr, "[line %u] in %s\n", line, runningPath != nullptr ? runningPath : "script");
+    vm.resetStack();
+    return false;
+}
+
+bool NativeRuntime::undefinedVariable(int slot, unsigned line)
+{
+    std::string message = std::string("Undefined variable '") + vm.globals.name(slot)->getChars() + "'.";
+    return error(line, message.c_str());
+}
+
+bool NativeRuntime::undefinedAssignment(int slot, unsigned line)
+{
+    std::string message = std::string("Undefined varible: '") + vm.globals.name(slot)->getChars() + "'";
+    return error(line, message.c_str());
+}
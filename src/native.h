@@ -0,0 +1,98 @@
+#ifndef CXXLOX_NATIVE_H
+#define CXXLOX_NATIVE_H
+
+#include <bit>
+
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+
+class NativeRuntime;
+
+// The tables a program translated by --emit-cpp (see transpiler.h) describes itself with; the generated code has them
+// as constant data, and NativeRuntime::main() turns them back into a VM's globals and constants.
+struct NativeConstant
+{
+    enum Kind : uint8_t
+    {
+        NUMBER,
+        STRING,
+        NIL,
+        FALSE,
+        TRUE,
+    };
+
+    Kind kind;
+    uint64_t bits;  // of a NUMBER's double, so that -0 and every NaN come back as they were
+    const char *chars;  // of a STRING
+    int length;
+};
+
+struct NativeChunk
+{
+    const char *path;  // of a module, which its runtime errors are reported against; nullptr for the script
+    const NativeConstant *constants;
+    size_t constantCount;
+    // runs the chunk with its stack starting at stack; false after a runtime error, which has already been reported
+    bool (*run)(NativeRuntime &runtime, Value *stack);
+};
+
+struct NativeProgram
+{
+    const char *const *globals;  // the names of the global slots, in slot order
+    size_t globalCount;
+    const NativeChunk *chunks;  // the script, then the modules in the order of their OP_IMPORT operands
+    size_t chunkCount;
+};
+
+// What the code of a translated program runs on: a VM that holds its globals, strings and heap, and reports errors as
+// the interpreter does. The fast paths the generated code needs are inline here, everything that allocates or fails is
+// not.
+//
+// The generated code keeps its stack in the VM's, so the collector finds its values; every call that may allocate gets
+// the stack top the interpreter would have at that point.
+class NativeRuntime
+{
+public:
+    // runs program in a VM of its own; returns the exit status cxxlox would have for the script
+    static int main(const NativeProgram &program);
+
+    Value *globals() { return vm.globals.values(); }
+    // those of the chunk with index chunk in NativeProgram::chunks
+    const Value *constants(size_t chunk) const { return pool.constants.values.data() + constantOffsets[chunk]; }
+
+    // valuesEqual() on the two values below top
+    bool equal(Value *top)
+    {
+        if (IS_NUMBER(top[-1]) && IS_NUMBER(top[-2])) { return AS_NUMBER(top[-2]) == AS_NUMBER(top[-1]); }
+        // comparing a rope flattens it, which allocates, so the operands stay on the stack until the result is known
+        vm.stackTop = top;
+        return valuesEqual(top[-2], top[-1]);
+    }
+
+    // the rest of OP_ADD once its operands are not both numbers: concatenates two strings, or reports the error
+    bool add(Value *top, unsigned line);
+    void print(Value *top);
+    // the module runs as the interpreter would run it; an error in it has already been reported
+    bool import(uint32_t module, Value *top);
+
+    // each reports a runtime error at line of the chunk running and returns false
+    bool error(unsigned line, const char *message);
+    bool undefinedVariable(int slot, unsigned line);
+    bool undefinedAssignment(int slot, unsigned line);
+
+private:
+    VM vm;
+    const NativeProgram &program;
+    // the constants of every chunk, one after the other, which are roots for as long as the program runs
+    Chunk pool;
+    std::vector<size_t> constantOffsets;  // indexed like NativeProgram::chunks, as is imported
+    std::vector<bool> imported;
+    const char *runningPath = nullptr;  // that of the module running, nullptr while the script runs
+
+    explicit NativeRuntime(const NativeProgram &program) : program(program) {}
+
+    void load();
+    bool run(size_t chunk, Value *stack);
+};
+#endif
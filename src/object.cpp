@@ -1,65 +1,138 @@
+#include <bit>
 #include <cstring>
+#include <vector>
 
 #include "memory.h"
 #include "object.h"
 #include "value.h"
 #include "vm.h"
 
-extern VM vm;
+void *Obj::operator new(size_t size, VM &vm) { return reallocate(vm, nullptr, 0, size); }
 
-void *Obj::operator new(size_t size) { return reallocate(nullptr, 0, size); }
-
-void Obj::operator delete(void *p) { reallocate(p, -1, 0); }
-
-Obj::Obj(ObjType type)
+Obj::Obj(VM &vm, ObjType type)
 {
     this->type = type;
     next = vm.objects;
     vm.objects = this;
 }
 
-ObjString::ObjString(char *chars, int length, uint32_t hash) : Obj(OBJ_STRING), length(length), chars(chars), hash(hash) { vm.strings.set(this, NIL_VAL); }
-
-ObjString::~ObjString() { FREE_ARRAY(char, chars, length + 1); }
+ObjString::ObjString(VM &vm, int length, uint32_t hash) : Obj(vm, OBJ_STRING), length(length), hash(hash) { vm.strings.add(this); }
 
-static uint32_t hashString(const char *key, int length)
+// Mixes a 64-bit word per step instead of a byte, then folds the state with the MurmurHash3 finalizer
+// so that the low bits used for bucket selection depend on every input byte.
+uint32_t hashString(const char *key, int length)
 {
-    uint32_t hash = 2166136261u;
-    for (int i = 0; i != length; ++i) {
-        hash ^= key[i];
-        hash *= 16777619;
+    constexpr uint64_t MULTIPLIER = 0x9e3779b97f4a7c15u;
+    uint64_t hash = 0xcbf29ce484222325u ^ static_cast<uint64_t>(length);
+    for (; length >= 8; key += 8, length -= 8) {
+        uint64_t word;
+        memcpy(&word, key, 8);
+        hash = (std::rotl(hash, 29) ^ word) * MULTIPLIER;
     }
-    return hash;
-}
-
-ObjString *takeString(char *chars, int length)
-{
-    uint32_t hash = hashString(chars, length);
-    ObjString *interned = vm.strings.findString(chars, length, hash);
-    if (interned != nullptr) {
-        FREE_ARRAY(char, chars, length + 1);
-        return interned;
+    // the remaining 0-7 bytes are gathered with fixed-size (possibly overlapping) loads rather than a variable-length copy
+    uint64_t tail = 0;
+    if (length >= 4) {
+        uint32_t low, high;
+        memcpy(&low, key, 4);
+        memcpy(&high, key + length - 4, 4);
+        tail = static_cast<uint64_t>(high) << 32 | low;
+    } else if (length > 0) {
+        tail = static_cast<uint64_t>(static_cast<uint8_t>(key[0])) << 16 | static_cast<uint64_t>(static_cast<uint8_t>(key[length >> 1])) << 8 |
+               static_cast<uint8_t>(key[length - 1]);
     }
-    return new ObjString(chars, length, hash);
+    hash = (std::rotl(hash, 29) ^ tail) * MULTIPLIER;
+
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdu;
+    hash ^= hash >> 33;
+    return static_cast<uint32_t>(hash);
 }
 
-ObjString *copyString(const char *chars, int length)
+ObjString *copyString(VM &vm, const char *chars, int length)
 {
     uint32_t hash = hashString(chars, length);
     ObjString *interned = vm.strings.findString(chars, length, hash);
     if (interned != nullptr) { return interned; }
-    char *heapChars = ALLOCATE(char, length + 1);
+
+    void *storage = reallocate(vm, nullptr, 0, ObjString::storageSize(length));
+    char *heapChars = ObjString::charsOf(storage);
     memcpy(heapChars, chars, length);
     heapChars[length] = '\0';
-    return new ObjString(heapChars, length, hash);
+    return new (storage) ObjString(vm, length, hash);
 }
 
-ObjString *ObjString::concatenate(const ObjString &rhs)
+ObjString *ObjString::concatenate(VM &vm, const ObjString &rhs)
 {
+    // the result is written straight into the storage of a new string
     int length = this->length + rhs.length;
-    char *chars = ALLOCATE(char, length + 1);
-    memcpy(chars, this->chars, this->length);
-    memcpy(chars + this->length, rhs.chars, rhs.length);
+    void *storage = reallocate(vm, nullptr, 0, storageSize(length));
+    char *chars = charsOf(storage);
+    memcpy(chars, getChars(), this->length);
+    memcpy(chars + this->length, rhs.getChars(), rhs.length);
     chars[length] = '\0';
-    return takeString(chars, length);
+    return intern(vm, storage, length);
+}
+
+ObjString *ObjString::intern(VM &vm, void *storage, int length)
+{
+    const char *chars = charsOf(storage);
+    uint32_t hash = hashString(chars, length);
+    ObjString *interned = vm.strings.findString(chars, length, hash);
+    if (interned != nullptr) {
+        reallocate(vm, storage, storageSize(length), 0);
+        return interned;
+    }
+    return new (storage) ObjString(vm, length, hash);
+}
+
+// a rope that has already been flattened is replaced by its string, so that the nodes below it can be collected
+Obj *ObjRope::flattenedOr(Obj *string)
+{
+    if (string->getType() == OBJ_ROPE && static_cast<ObjRope *>(string)->flat != nullptr) { return static_cast<ObjRope *>(string)->flat; }
+    return string;
+}
+
+ObjRope::ObjRope(VM &vm, Obj *left, Obj *right, int length)
+    : Obj(vm, OBJ_ROPE), vm(vm), left(flattenedOr(left)), right(flattenedOr(right)), length(length)
+{
+}
+
+ObjString *ObjRope::flatten()
+{
+    if (flat != nullptr) { return flat; }
+
+    void *storage = reallocate(vm, nullptr, 0, ObjString::storageSize(length));
+    char *chars = ObjString::charsOf(storage);
+
+    // ropes built by appending lean deeply to the left, so the leaves are visited with an explicit stack
+    char *end = chars;
+    std::vector<Obj *> pending{this};
+    while (!pending.empty()) {
+        Obj *node = pending.back();
+        pending.pop_back();
+        if (node->getType() == OBJ_ROPE && static_cast<ObjRope *>(node)->flat != nullptr) { node = static_cast<ObjRope *>(node)->flat; }
+        if (node->getType() == OBJ_STRING) {
+            ObjString *leaf = static_cast<ObjString *>(node);
+            memcpy(end, leaf->getChars(), leaf->getLength());
+            end += leaf->getLength();
+        } else {
+            ObjRope *rope = static_cast<ObjRope *>(node);
+            pending.push_back(rope->right);
+            pending.push_back(rope->left);
+        }
+    }
+    *end = '\0';
+
+    flat = ObjString::intern(vm, storage, length);
+    left = right = nullptr;
+    return flat;
+}
+
+Obj *concatenateStrings(VM &vm, Obj *a, Obj *b)
+{
+    int length = stringLength(a) + stringLength(b);
+    if (length < ROPE_MIN_LENGTH && a->getType() == OBJ_STRING && b->getType() == OBJ_STRING) {
+        return static_cast<ObjString *>(a)->concatenate(vm, *static_cast<ObjString *>(b));
+    }
+    return new (vm) ObjRope(vm, a, b, length);
 }
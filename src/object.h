@@ -2,65 +2,130 @@
 #define CXXLOX_OBJECT_H
 
 #include <cstring>
+#include <new>
 
 #include "common.h"
 #include "value.h"
 
 #define OBJ_TYPE(value) (AS_OBJ(value)->getType())
 
+#define IS_ROPE(value) isObjType(value, OBJ_ROPE)
 #define IS_STRING(value) isObjType(value, OBJ_STRING)
+// either representation of a Lox string
+#define IS_ANY_STRING(value) (IS_STRING(value) || IS_ROPE(value))
 
+#define AS_ROPE(value) ((ObjRope *) AS_OBJ(value))
 #define AS_STRING(value) ((ObjString *) AS_OBJ(value))
 #define AS_CSTRING(value) (static_cast<ObjString *>(AS_OBJ(value))->getChars())
 
+// shorter concatenations are copied right away; below this size a rope node would not save anything
+constexpr int ROPE_MIN_LENGTH = 64;
+
 enum ObjType
 {
+    OBJ_ROPE,
     OBJ_STRING,
 };
 
+class VM;
+
 class Obj
 {
-public:
-    void *operator new(size_t size);
-    void operator delete(void *p);
+    friend class VM;
 
-    Obj(ObjType type);
+public:
+    // objects are allocated from the heap of the VM that owns them, as in new (vm) ObjRope(...), and freed by it
+    void *operator new(size_t size, VM &vm);
+    void *operator new(size_t size, void *storage) { return storage; }
+    // called if a constructor throws, and left to the allocator, which gets its memory back with the VM's
+    void operator delete(void *, VM &) {}
+    void operator delete(void *, void *) {}
+
+    Obj(VM &vm, ObjType type);
     virtual ~Obj() = default;
 
-    bool getType() { return type; }
+    virtual size_t allocationSize() const = 0;
+
+    ObjType getType() const { return type; }
     Obj *getNext() { return next; }
+    bool isMarked() const { return marked; }
+
+protected:
+    // only the virtual destructors refer to this; an object is never deleted but freed by VM::freeObject()
+    void operator delete(void *) {}
 
 private:
     ObjType type;
+    bool marked = false;
     Obj *next = nullptr;
 };
 
+// The characters, including a terminating '\0', are stored right behind the object in the same allocation.
 class ObjString : public Obj
 {
     friend bool operator==(const ObjString &lhs, const ObjString &rhs);
     friend struct std::hash<ObjString *>;
+    friend class ObjRope;
+    friend ObjString *copyString(VM &vm, const char *chars, int length);
 
 public:
-    ObjString(char *chars, int length, uint32_t hash);
-    ~ObjString();
-
     // the semantics of concatenate() is different from operator+()
-    ObjString *concatenate(const ObjString &rhs);
+    ObjString *concatenate(VM &vm, const ObjString &rhs);
 
     bool equals(const char *chars, int length, uint32_t hash) const
     {
-        return this->length == length && this->hash == hash && !std::memcmp(this->chars, chars, length);
+        return this->length == length && this->hash == hash && !std::memcmp(getChars(), chars, length);
     }
 
-    char *getChars() const { return chars; }
+    const char *getChars() const { return reinterpret_cast<const char *>(this + 1); }
+    int getLength() const { return length; }
+    uint32_t getHash() const { return hash; }
+
+    size_t allocationSize() const override { return storageSize(length); }
 
 private:
     int length;
-    char *chars;
     uint32_t hash;
+
+    // the characters must already have been written to the storage the object is constructed in
+    ObjString(VM &vm, int length, uint32_t hash);
+
+    static size_t storageSize(int length) { return sizeof(ObjString) + length + 1; }
+    static char *charsOf(void *storage) { return static_cast<char *>(storage) + sizeof(ObjString); }
+    // turns storage whose characters have been written into a string, unless an equal string is already interned,
+    // in which case the storage is freed and that string returned
+    static ObjString *intern(VM &vm, void *storage, int length);
+};
+
+// A concatenation whose characters have not been gathered yet. Appending to a rope only allocates a new node, so a
+// string built piece by piece costs time linear in its length; its characters are copied, hashed and interned once,
+// the first time it is compared or printed.
+class ObjRope : public Obj
+{
+    friend class VM;
+
+public:
+    ObjRope(VM &vm, Obj *left, Obj *right, int length);
+
+    ObjString *flatten();
+
+    int getLength() const { return length; }
+
+    size_t allocationSize() const override { return sizeof(ObjRope); }
+
+private:
+    static Obj *flattenedOr(Obj *string);
+
+    // flattening allocates the string from here; a rope fits the same size class with this as without it
+    VM &vm;
+    // each an ObjString or ObjRope; both are dropped once the rope has been flattened
+    Obj *left;
+    Obj *right;
+    ObjString *flat = nullptr;
+    int length;
 };
 
-inline bool operator==(const ObjString &lhs, const ObjString &rhs) { return lhs.equals(rhs.chars, rhs.length, rhs.hash); }
+inline bool operator==(const ObjString &lhs, const ObjString &rhs) { return lhs.equals(rhs.getChars(), rhs.length, rhs.hash); }
 
 template <>
 struct std::hash<ObjString *>
@@ -70,6 +135,14 @@ struct std::hash<ObjString *>
 
 static inline bool isObjType(Value value, ObjType type) { return IS_OBJ(value) && AS_OBJ(value)->getType() == type; }
 
-ObjString *takeString(char *chars, int length);
-ObjString *copyString(const char *chars, int length);
+static inline int stringLength(Obj *string)
+{
+    return string->getType() == OBJ_STRING ? static_cast<ObjString *>(string)->getLength() : static_cast<ObjRope *>(string)->getLength();
+}
+
+// the hash every ObjString carries, for looking one up by its characters without allocating it
+uint32_t hashString(const char *key, int length);
+ObjString *copyString(VM &vm, const char *chars, int length);
+// concatenates two strings or ropes, deferring the copy to a rope once the result reaches ROPE_MIN_LENGTH
+Obj *concatenateStrings(VM &vm, Obj *a, Obj *b);
 #endif
@@ -0,0 +1,295 @@
+#include "optimizer.h"
+
+#include "object.h"
+
+void Optimizer::optimize()
+{
+    for (size_t offset = 0; offset < chunk.code.size();) {
+        offset = decode(offset);
+        if (code.size() == 2 * WINDOW) { encode(WINDOW); }
+    }
+    encode(code.size());
+    // nothing allocates after the last rewrite, so the constants that are only referenced from optimized stay
+    // reachable through the old pool until it is replaced
+    chunk = std::move(optimized);
+}
+
+// appends the instruction at offset and returns the offset of the next one
+size_t Optimizer::decode(size_t offset)
+{
+    OpCode op = static_cast<OpCode>(chunk.code[offset]);
+    // instructions are decoded in order, so the line table is walked rather than searched
+    while (lineRun + 1 < chunk.lines.size() && chunk.lines[lineRun + 1].offset <= offset) { ++lineRun; }
+    Instruction instruction{NIL_VAL, chunk.lines[lineRun].line, 0, op};
+    switch (op) {
+    case OP_CONSTANT:
+    case OP_CONSTANT_LONG:
+        instruction.value = chunk.constants.values[chunk.readOperand(offset)];
+        instruction.op = OP_CONSTANT;
+        break;
+    case OP_DEFINE_GLOBAL:
+    case OP_DEFINE_GLOBAL_LONG:
+        instruction.operand = chunk.readOperand(offset);
+        instruction.op = OP_DEFINE_GLOBAL;
+        break;
+    case OP_GET_GLOBAL:
+    case OP_GET_GLOBAL_LONG:
+        instruction.operand = chunk.readOperand(offset);
+        instruction.op = OP_GET_GLOBAL;
+        break;
+    case OP_IMPORT:
+    case OP_IMPORT_LONG:
+        instruction.operand = chunk.readOperand(offset);
+        instruction.op = OP_IMPORT;
+        break;
+    case OP_SET_GLOBAL:
+    case OP_SET_GLOBAL_LONG:
+        instruction.operand = chunk.readOperand(offset);
+        instruction.op = OP_SET_GLOBAL;
+        break;
+    default:
+        break;
+    }
+    append(instruction);
+    return offset + 1 + operandSize(op);
+}
+
+// encodes at least the first count decoded instructions, adding their constants to a new, compacted pool; a
+// superinstruction may take up to two more, which are far enough from the end of the code that no rewrite can touch them
+void Optimizer::encode(size_t count)
+{
+    size_t index = 0;
+    while (index < count) {
+        size_t fused = level >= 2 ? encodeSuperinstruction(index) : 0;
+        if (fused == 0) {
+            encodeInstruction(code[index]);
+            fused = 1;
+        }
+        index += fused;
+    }
+    code.erase(code.begin(), code.begin() + index);
+}
+
+void Optimizer::encodeInstruction(const Instruction &instruction)
+{
+    switch (instruction.op) {
+    case OP_CONSTANT:
+        // there are never more constants than OP_CONSTANT instructions, so the compacted pool is no larger than the
+        // original one and its indices still fit the operand
+        optimized.writeOperand(OP_CONSTANT, optimized.addConstant(instruction.value), instruction.line);
+        break;
+    case OP_DEFINE_GLOBAL:
+    case OP_GET_GLOBAL:
+    case OP_IMPORT:
+    case OP_SET_GLOBAL:
+        optimized.writeOperand(instruction.op, instruction.operand, instruction.line);
+        break;
+    default:
+        optimized.write(instruction.op, instruction.line);
+        break;
+    }
+}
+
+// returns the number of instructions fused into the superinstruction written at index, 0 if none matches there
+size_t Optimizer::encodeSuperinstruction(size_t index)
+{
+    for (const Superinstruction &super : SUPERINSTRUCTIONS) {
+        if (index + super.length > code.size()) { continue; }
+        unsigned line = code[index].line;
+        uint32_t operands[3];
+        int operandCount = 0;
+        bool matches = true;
+        for (int i = 0; i != super.length && matches; ++i) {
+            const Instruction &part = code[index + i];
+            matches = part.op == super.parts[i] && part.line == line;
+            if (!matches || operandSize(part.op) == 0) { continue; }
+            // the constant is added even if the sequence turns out not to fit, but then the plain instruction uses it
+            operands[operandCount] = part.op == OP_CONSTANT ? optimized.addConstant(part.value) : part.operand;
+            matches = operands[operandCount++] <= MAX_SHORT_OPERAND;
+        }
+        if (!matches) { continue; }
+
+        optimized.write(super.op, line);
+        for (int i = 0; i != operandCount; ++i) { optimized.write(static_cast<uint8_t>(operands[i]), line); }
+        return super.length;
+    }
+    return 0;
+}
+
+// rewrites are applied to the tail of the output after every instruction, so that a folded constant can feed the
+// instruction after it: 1 + 2 * 3 becomes a single OP_CONSTANT
+void Optimizer::append(const Instruction &instruction)
+{
+    code.push_back(instruction);
+    while (rewriteTail()) {}
+}
+
+bool Optimizer::rewriteTail() { return foldUnary() || foldBinary() || invertComparison() || dropUnusedConstant() || reuseAssignedValue(); }
+
+bool Optimizer::constantOf(const Instruction &instruction, Value &value) const
+{
+    switch (instruction.op) {
+    case OP_CONSTANT:
+        value = instruction.value;
+        return true;
+    case OP_FALSE:
+        value = BOOL_VAL(false);
+        return true;
+    case OP_NIL:
+        value = NIL_VAL;
+        return true;
+    case OP_TRUE:
+        value = BOOL_VAL(true);
+        return true;
+    default:
+        return false;
+    }
+}
+
+Optimizer::Instruction Optimizer::makeConstant(Value value, unsigned line)
+{
+    if (IS_NIL(value)) { return Instruction{NIL_VAL, line, 0, OP_NIL}; }
+    if (IS_BOOL(value)) { return Instruction{NIL_VAL, line, 0, AS_BOOL(value) ? OP_TRUE : OP_FALSE}; }
+    // a string made here is referenced by nothing but this optimizer, so it is also kept in the pool of the chunk being
+    // optimized, which the collector marks, until that pool is replaced
+    if (IS_OBJ(value)) { chunk.addConstant(value); }
+    return Instruction{value, line, 0, OP_CONSTANT};
+}
+
+bool Optimizer::foldUnary()
+{
+    if (code.size() < 2) { return false; }
+    const Instruction &op = code[code.size() - 1];
+    Value operand;
+    if (!constantOf(code[code.size() - 2], operand)) { return false; }
+
+    Value result;
+    switch (op.op) {
+    case OP_NEGATE:
+        if (!IS_NUMBER(operand)) { return false; }
+        result = NUMBER_VAL(-AS_NUMBER(operand));
+        break;
+    case OP_NOT:
+        result = BOOL_VAL(isFalsey(operand));
+        break;
+    default:
+        return false;
+    }
+
+    Instruction folded = makeConstant(result, op.line);
+    code.resize(code.size() - 2);
+    code.push_back(folded);
+    return true;
+}
+
+bool Optimizer::foldBinary()
+{
+    if (code.size() < 3) { return false; }
+    const Instruction &op = code[code.size() - 1];
+    Value a, b;
+    if (!constantOf(code[code.size() - 3], a) || !constantOf(code[code.size() - 2], b)) { return false; }
+
+    Value result;
+    switch (op.op) {
+    case OP_EQUAL:
+    case OP_NOT_EQUAL:
+        // only flat strings are ever constants, so this never has to flatten a rope
+        result = BOOL_VAL(valuesEqual(a, b) == (op.op == OP_EQUAL));
+        break;
+    case OP_ADD:
+        if (IS_STRING(a) && IS_STRING(b)) {
+            result = OBJ_VAL(AS_STRING(a)->concatenate(vm, *AS_STRING(b)));
+            break;
+        }
+        [[fallthrough]];
+    default:
+        if (!IS_NUMBER(a) || !IS_NUMBER(b)) { return false; }
+        switch (op.op) {
+        case OP_ADD:
+            result = NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b));
+            break;
+        case OP_DIVIDE:
+            result = NUMBER_VAL(AS_NUMBER(a) / AS_NUMBER(b));
+            break;
+        case OP_GREATER:
+            result = BOOL_VAL(AS_NUMBER(a) > AS_NUMBER(b));
+            break;
+        case OP_GREATER_EQUAL:
+            result = BOOL_VAL(!(AS_NUMBER(a) < AS_NUMBER(b)));
+            break;
+        case OP_LESS:
+            result = BOOL_VAL(AS_NUMBER(a) < AS_NUMBER(b));
+            break;
+        case OP_LESS_EQUAL:
+            result = BOOL_VAL(!(AS_NUMBER(a) > AS_NUMBER(b)));
+            break;
+        case OP_MULTIPLY:
+            result = NUMBER_VAL(AS_NUMBER(a) * AS_NUMBER(b));
+            break;
+        case OP_SUBTRACT:
+            result = NUMBER_VAL(AS_NUMBER(a) - AS_NUMBER(b));
+            break;
+        default:
+            return false;
+        }
+    }
+
+    Instruction folded = makeConstant(result, op.line);
+    code.resize(code.size() - 3);
+    code.push_back(folded);
+    return true;
+}
+
+// a comparison followed by OP_NOT becomes the opposite comparison; OP_GREATER_EQUAL and OP_LESS_EQUAL are defined as
+// !(a < b) and !(a > b), so the rewrite also holds for NaN
+bool Optimizer::invertComparison()
+{
+    if (code.size() < 2 || code.back().op != OP_NOT) { return false; }
+    Instruction &comparison = code[code.size() - 2];
+    switch (comparison.op) {
+    case OP_EQUAL:
+        comparison.op = OP_NOT_EQUAL;
+        break;
+    case OP_GREATER:
+        comparison.op = OP_LESS_EQUAL;
+        break;
+    case OP_GREATER_EQUAL:
+        comparison.op = OP_LESS;
+        break;
+    case OP_LESS:
+        comparison.op = OP_GREATER_EQUAL;
+        break;
+    case OP_LESS_EQUAL:
+        comparison.op = OP_GREATER;
+        break;
+    case OP_NOT_EQUAL:
+        comparison.op = OP_EQUAL;
+        break;
+    default:
+        return false;
+    }
+    code.pop_back();
+    return true;
+}
+
+// an expression statement whose value folded to a constant
+bool Optimizer::dropUnusedConstant()
+{
+    Value value;
+    if (code.size() < 2 || code.back().op != OP_POP || !constantOf(code[code.size() - 2], value)) { return false; }
+    code.resize(code.size() - 2);
+    return true;
+}
+
+// "a = x; print a;": the assigned value is still on the stack before the OP_POP, and reading the variable back cannot
+// fail since the assignment already checked that it is defined
+bool Optimizer::reuseAssignedValue()
+{
+    if (code.size() < 3) { return false; }
+    const Instruction &set = code[code.size() - 3];
+    const Instruction &pop = code[code.size() - 2];
+    const Instruction &get = code[code.size() - 1];
+    if (set.op != OP_SET_GLOBAL || pop.op != OP_POP || get.op != OP_GET_GLOBAL || set.operand != get.operand) { return false; }
+    code.resize(code.size() - 2);
+    return true;
+}
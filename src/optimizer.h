@@ -0,0 +1,64 @@
+#ifndef CXXLOX_OPTIMIZER_H
+#define CXXLOX_OPTIMIZER_H
+
+#include <vector>
+
+#include "chunk.h"
+#include "value.h"
+
+class VM;
+
+// Peephole optimizer run over a finished chunk (-O1), which also fuses superinstructions at -O2.
+//
+// The chunk is decoded into a list of instructions, rewritten and encoded again with a compacted constant pool. Every
+// rewrite keeps the observable behaviour of the code, including which runtime errors are reported and on which line:
+// an expression is only folded if evaluating it cannot fail.
+//
+// The pass relies on the code being straight-line; it has to learn to patch jump offsets once the language has them.
+class Optimizer
+{
+public:
+    // strings folded from constants are allocated from vm
+    Optimizer(VM &vm, Chunk &chunk, int level) : vm(vm), chunk(chunk), level(level) {}
+
+    void optimize();
+
+private:
+    struct Instruction
+    {
+        Value value;  // constant of OP_CONSTANT
+        unsigned line;
+        uint32_t operand;  // global slot of the *_GLOBAL instructions, module of OP_IMPORT
+        OpCode op;         // always the short form, encode() picks the form that fits the operand
+    };
+
+    // rewrites only look at the end of the decoded code, so all but this many instructions are encoded as soon as
+    // possible; a longer chain of constant operands is only optimized partially
+    static constexpr size_t WINDOW = 1024;
+
+    VM &vm;
+    Chunk &chunk;
+    int level;
+    Chunk optimized;
+    std::vector<Instruction> code;  // decoded, but not yet encoded into optimized
+    size_t lineRun = 0;             // run of the chunk's line table the instruction being decoded belongs to
+
+    size_t decode(size_t offset);
+    void encode(size_t count);
+    void encodeInstruction(const Instruction &instruction);
+    size_t encodeSuperinstruction(size_t index);
+
+    void append(const Instruction &instruction);
+    bool rewriteTail();
+    bool foldUnary();
+    bool foldBinary();
+    bool invertComparison();
+    bool dropUnusedConstant();
+    bool reuseAssignedValue();
+
+    bool constantOf(const Instruction &instruction, Value &value) const;
+    Instruction makeConstant(Value value, unsigned line);
+};
+
+static inline void optimizeChunk(VM &vm, Chunk &chunk, int level) { Optimizer(vm, chunk, level).optimize(); }
+#endif
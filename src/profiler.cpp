@@ -0,0 +1,107 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <numeric>
+
+#include "debug.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+static constexpr const char *TIME_UNIT = "cycles";
+#else
+static constexpr const char *TIME_UNIT = "ns";
+#endif
+
+void Profiler::beginChunk(const Chunk &chunk, std::string_view name)
+{
+    if (pairCounts.empty()) { pairCounts.resize(256 * 256); }
+    if (this->chunk != nullptr) {
+        chargePrevious();
+        suspended.push_back(Suspended{this->chunk, std::move(this->name), std::move(offsetCounts), std::move(offsetTime)});
+    }
+    this->chunk = &chunk;
+    this->name = name;
+    offsetCounts.assign(chunk.code.size(), 0);
+    offsetTime.assign(chunk.code.size(), 0);
+}
+
+void Profiler::endChunk()
+{
+    chargePrevious();
+    for (size_t offset = 0; offset != offsetCounts.size(); ++offset) {
+        if (offsetCounts[offset] == 0) { continue; }
+        LineProfile &line = lines[{name, chunk->getLine(offset)}];
+        line.count += offsetCounts[offset];
+        line.time += offsetTime[offset];
+    }
+    if (suspended.empty()) {
+        chunk = nullptr;
+        name.clear();
+        offsetCounts.clear();
+        offsetTime.clear();
+        return;
+    }
+    Suspended &outer = suspended.back();
+    chunk = outer.chunk;
+    name = std::move(outer.name);
+    offsetCounts = std::move(outer.offsetCounts);
+    offsetTime = std::move(outer.offsetTime);
+    suspended.pop_back();
+}
+
+// the instruction recorded last runs until now; the next one recorded does not follow it
+void Profiler::chargePrevious()
+{
+    if (previousOffset != NO_OFFSET) {
+        uint64_t elapsed = now() - previousStart;
+        opcodeTime[previousOp] += elapsed;
+        offsetTime[previousOffset] += elapsed;
+    }
+    previousOffset = NO_OFFSET;
+}
+
+static double percent(uint64_t part, uint64_t total) { return total == 0 ? 0.0 : 100.0 * part / total; }
+
+void Profiler::report(FILE *out, size_t limit) const
+{
+    uint64_t totalCount = std::accumulate(opcodeCounts.begin(), opcodeCounts.end(), uint64_t{0});
+    uint64_t totalTime = std::accumulate(opcodeTime.begin(), opcodeTime.end(), uint64_t{0});
+    fprintf(out, "profile: %llu instructions, %llu %s\n", static_cast<unsigned long long>(totalCount), static_cast<unsigned long long>(totalTime), TIME_UNIT);
+
+    std::vector<int> ops;
+    for (int op = 0; op != 256; ++op) {
+        if (opcodeCounts[op] != 0) { ops.push_back(op); }
+    }
+    std::sort(ops.begin(), ops.end(), [this](int a, int b) { return opcodeTime[a] > opcodeTime[b]; });
+    fprintf(out, "%-32s %12s %7s %14s %7s %10s\n", "opcode", "count", "%", TIME_UNIT, "%", "per op");
+    for (int op : ops) {
+        const char *name = opcodeName(static_cast<OpCode>(op));
+        fprintf(out, "%-32s %12llu %6.2f%% %14llu %6.2f%% %10.1f\n", name != nullptr ? name : "?", static_cast<unsigned long long>(opcodeCounts[op]),
+                percent(opcodeCounts[op], totalCount), static_cast<unsigned long long>(opcodeTime[op]), percent(opcodeTime[op], totalTime),
+                static_cast<double>(opcodeTime[op]) / opcodeCounts[op]);
+    }
+
+    std::vector<int> pairs;
+    for (int pair = 0; pair != static_cast<int>(pairCounts.size()); ++pair) {
+        if (pairCounts[pair] != 0) { pairs.push_back(pair); }
+    }
+    std::sort(pairs.begin(), pairs.end(), [this](int a, int b) { return pairCounts[a] > pairCounts[b]; });
+    if (pairs.size() > limit) { pairs.resize(limit); }
+    fprintf(out, "\n%-65s %12s %7s\n", "pair", "count", "%");
+    for (int pair : pairs) {
+        const char *first = opcodeName(static_cast<OpCode>(pair >> 8));
+        const char *second = opcodeName(static_cast<OpCode>(pair & 0xff));
+        fprintf(out, "%-32s %-32s %12llu %6.2f%%\n", first != nullptr ? first : "?", second != nullptr ? second : "?",
+                static_cast<unsigned long long>(pairCounts[pair]), percent(pairCounts[pair], totalCount));
+    }
+
+    std::vector<std::pair<std::pair<std::string, unsigned>, LineProfile>> hotLines(lines.begin(), lines.end());
+    std::sort(hotLines.begin(), hotLines.end(), [](const auto &a, const auto &b) { return a.second.time > b.second.time; });
+    if (hotLines.size() > limit) { hotLines.resize(limit); }
+    fprintf(out, "\n%-8s %12s %7s %14s %7s\n", "line", "count", "%", TIME_UNIT, "%");
+    for (const auto &[key, profile] : hotLines) {
+        // lines of the script are plain numbers, those of a module are prefixed with its path
+        std::string line = key.first.empty() ? std::to_string(key.second) : key.first + ":" + std::to_string(key.second);
+        fprintf(out, "%-8s %12llu %6.2f%% %14llu %6.2f%%\n", line.c_str(), static_cast<unsigned long long>(profile.count), percent(profile.count, totalCount),
+                static_cast<unsigned long long>(profile.time), percent(profile.time, totalTime));
+    }
+}
@@ -0,0 +1,104 @@
+#ifndef CXXLOX_PROFILER_H
+#define CXXLOX_PROFILER_H
+
+#include <array>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "chunk.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <ctime>
+#endif
+
+// Counts the instructions VM::run<Profiled>() executes, per opcode, per pair of consecutive opcodes and per source
+// line, and times each of them: the time from the start of one instruction to the start of the next is charged to the
+// first. Time is read with rdtsc where there is one, so it is in (reference) cycles, and in nanoseconds elsewhere.
+//
+// Chunks nest: a module begins while the chunk importing it is suspended at its OP_IMPORT, which is charged the time
+// up to then and resumes when the module ends. Lines are told apart by the name of their chunk, empty for the script.
+class Profiler
+{
+public:
+    void beginChunk(const Chunk &chunk, std::string_view name);
+
+    // called before the instruction at offset executes
+    void record(size_t offset)
+    {
+        uint64_t start = now();
+        uint8_t op = chunk->code[offset];
+        if (previousOffset != NO_OFFSET) {
+            uint64_t elapsed = start - previousStart;
+            opcodeTime[previousOp] += elapsed;
+            offsetTime[previousOffset] += elapsed;
+            ++pairCounts[previousOp << 8 | op];
+        }
+        ++opcodeCounts[op];
+        ++offsetCounts[offset];
+        previousOp = op;
+        previousOffset = offset;
+        // read again so that the bookkeeping above is not charged to the instruction
+        previousStart = now();
+    }
+
+    // charges the last instruction, folds the counts of the chunk's code into its lines and resumes the chunk it
+    // was begun in, if any
+    void endChunk();
+
+    void report(FILE *out, size_t limit) const;
+
+private:
+    struct LineProfile
+    {
+        uint64_t count = 0;
+        uint64_t time = 0;
+    };
+
+    // a chunk waiting for the one begun in it to end
+    struct Suspended
+    {
+        const Chunk *chunk;
+        std::string name;
+        std::vector<uint64_t> offsetCounts;
+        std::vector<uint64_t> offsetTime;
+    };
+
+    static constexpr size_t NO_OFFSET = SIZE_MAX;
+
+    static uint64_t now()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        timespec time;
+        clock_gettime(CLOCK_MONOTONIC, &time);
+        return static_cast<uint64_t>(time.tv_sec) * 1000000000u + time.tv_nsec;
+#endif
+    }
+
+    void chargePrevious();
+
+    const Chunk *chunk = nullptr;
+    std::string name;
+    uint8_t previousOp = 0;
+    size_t previousOffset = NO_OFFSET;
+    uint64_t previousStart = 0;
+
+    std::array<uint64_t, 256> opcodeCounts{};
+    std::array<uint64_t, 256> opcodeTime{};
+    // allocated by the first chunk, since most VMs are never profiled
+    std::vector<uint64_t> pairCounts;
+    // of the chunk being run, indexed by code offset
+    std::vector<uint64_t> offsetCounts;
+    std::vector<uint64_t> offsetTime;
+    std::vector<Suspended> suspended;
+    // keyed by chunk name and line
+    std::map<std::pair<std::string, unsigned>, LineProfile> lines;
+};
+#endif
@@ -0,0 +1,524 @@
+#include "register.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "debug.h"
+#include "object.h"
+#include "vm.h"
+
+// the swappedOp of binary() for an operation whose operands cannot be swapped
+static constexpr OpCode NOT_SWAPPABLE = OP_RETURN;
+
+bool RegisterCompiler::compile()
+{
+    // the register code shares the constants of the code, with nil, true and false after them; the pool is not added to
+    // otherwise, so it is not indexed for addConstant()
+    std::vector<Value> &constants = registers.constants.values;
+    constants.reserve(code.constants.values.size() + 3);
+    constants = code.constants.values;
+    nilConstant = static_cast<uint32_t>(constants.size());
+    constants.push_back(NIL_VAL);
+    constants.push_back(BOOL_VAL(true));
+    constants.push_back(BOOL_VAL(false));
+    // an operation takes three bytes more than on the stack, but loading its operands takes none or one
+    registers.code.reserve(2 * code.code.size());
+    registers.lines.reserve(code.lines.size());
+
+    size_t lineRun = 0;
+    for (size_t offset = 0; offset < code.code.size() && !overflowed;) {
+        OpCode op = genericForm(static_cast<OpCode>(code.code[offset]));
+        while (lineRun + 1 < code.lines.size() && code.lines[lineRun + 1].offset <= offset) { ++lineRun; }
+        line = code.lines[lineRun].line;
+
+        const Superinstruction *super = findSuperinstruction(op);
+        if (super == nullptr) {
+            int size = operandSize(op);
+            translate(op, size == 0 ? 0 : size == 1 ? code.code[offset + 1] : code.readOperand(offset));
+            offset += 1 + size;
+            continue;
+        }
+        // the parts of a superinstruction one by one, each with its one byte operand
+        ++offset;
+        for (int i = 0; i != super->length && !overflowed; ++i) {
+            OpCode part = super->parts[i];
+            translate(part, operandSize(part) != 0 ? code.code[offset++] : 0);
+        }
+    }
+    return !overflowed;
+}
+
+// operand is the slot, constant or module of op, if it has one
+void RegisterCompiler::translate(OpCode op, uint32_t operand)
+{
+    switch (op) {
+    case OP_ADD:
+        // neither form of OP_R_ADD can take its operands swapped, since strings are concatenated in order
+        binary(OP_R_ADD, OP_R_ADD_K, NOT_SWAPPABLE);
+        break;
+    case OP_CONSTANT:
+    case OP_CONSTANT_LONG:
+        push(Operand{true, operand});
+        break;
+    case OP_DEFINE_GLOBAL:
+    case OP_DEFINE_GLOBAL_LONG:
+        emitIndex(OP_R_DEFINE_GLOBAL, load(stack.size() - 1), operand);
+        stack.pop_back();
+        break;
+    case OP_DIVIDE:
+        binary(OP_R_DIVIDE, OP_R_DIVIDE_K, NOT_SWAPPABLE);
+        break;
+    case OP_EQUAL:
+        binary(OP_R_EQUAL, OP_R_EQUAL_K, OP_R_EQUAL_K);
+        break;
+    case OP_FALSE:
+        push(Operand{true, nilConstant + 2});
+        break;
+    case OP_GET_GLOBAL:
+    case OP_GET_GLOBAL_LONG: {
+        uint8_t result = static_cast<uint8_t>(stack.size());
+        push(Operand{false, result});
+        emitIndex(OP_R_GET_GLOBAL, result, operand);
+        break;
+    }
+    case OP_GREATER:
+        binary(OP_R_GREATER, OP_R_GREATER_K, OP_R_LESS_K);
+        break;
+    case OP_GREATER_EQUAL:
+        binary(OP_R_GREATER_EQUAL, OP_R_GREATER_EQUAL_K, OP_R_LESS_EQUAL_K);
+        break;
+    case OP_IMPORT:
+    case OP_IMPORT_LONG:
+        registers.writeOperand(OP_R_IMPORT, operand, line);
+        break;
+    case OP_LESS:
+        binary(OP_R_LESS, OP_R_LESS_K, OP_R_GREATER_K);
+        break;
+    case OP_LESS_EQUAL:
+        binary(OP_R_LESS_EQUAL, OP_R_LESS_EQUAL_K, OP_R_GREATER_EQUAL_K);
+        break;
+    case OP_MULTIPLY:
+        binary(OP_R_MULTIPLY, OP_R_MULTIPLY_K, OP_R_MULTIPLY_K);
+        break;
+    case OP_NEGATE:
+    case OP_NOT: {
+        uint8_t value = load(stack.size() - 1);
+        emit(op == OP_NEGATE ? OP_R_NEGATE : OP_R_NOT, {value, value});
+        break;
+    }
+    case OP_NIL:
+        push(Operand{true, nilConstant});
+        break;
+    case OP_NOT_EQUAL:
+        binary(OP_R_NOT_EQUAL, OP_R_NOT_EQUAL_K, OP_R_NOT_EQUAL_K);
+        break;
+    case OP_POP:
+        stack.pop_back();
+        break;
+    case OP_PRINT:
+        emit(OP_R_PRINT, {load(stack.size() - 1)});
+        stack.pop_back();
+        break;
+    case OP_RETURN:
+        emit(OP_R_RETURN, {});
+        break;
+    case OP_SET_GLOBAL:
+    case OP_SET_GLOBAL_LONG:
+        // the value stays on the stack, now in its register
+        emitIndex(OP_R_SET_GLOBAL, load(stack.size() - 1), operand);
+        break;
+    case OP_SUBTRACT:
+        binary(OP_R_SUBTRACT, OP_R_SUBTRACT_K, NOT_SWAPPABLE);
+        break;
+    case OP_TRUE:
+        push(Operand{true, nilConstant + 1});
+        break;
+    default:
+        // superinstructions are translated part by part, and register instructions never occur in stack code
+        break;
+    }
+}
+
+// The two operands on top of the stack are replaced by the result, in the register of the first. A constant second
+// operand is taken by the *_K form; a constant first one by swappedOp, the *_K form of the operation with its operands
+// the other way around (a < 1 for 1 > a), unless it is NOT_SWAPPABLE. A constant is only loaded into a register if
+// neither fits.
+void RegisterCompiler::binary(OpCode registerOp, OpCode constantOp, OpCode swappedOp)
+{
+    Operand b = stack.back();
+    stack.pop_back();
+    Operand a = stack.back();
+    uint8_t result = static_cast<uint8_t>(stack.size() - 1);
+    if (!a.constant && b.constant && b.index <= MAX_SHORT_OPERAND) {
+        emit(constantOp, {result, result, static_cast<uint8_t>(b.index)});
+    } else if (a.constant && !b.constant && a.index <= MAX_SHORT_OPERAND && swappedOp != NOT_SWAPPABLE) {
+        emit(swappedOp, {result, static_cast<uint8_t>(result + 1), static_cast<uint8_t>(a.index)});
+    } else {
+        // the first operand is loaded first, as it would have been pushed first
+        load(result);
+        stack.push_back(b);
+        load(result + 1);
+        stack.pop_back();
+        emit(registerOp, {result, result, static_cast<uint8_t>(result + 1)});
+    }
+    stack.back() = Operand{false, result};
+}
+
+void RegisterCompiler::push(Operand operand)
+{
+    // one more value would need one more register than there are, or than an operand can name
+    if (stack.size() == static_cast<size_t>(std::min(maxRegisters, static_cast<int>(MAX_SHORT_OPERAND) + 1))) {
+        overflowed = true;
+        return;
+    }
+    stack.push_back(operand);
+    registerCount = std::max(registerCount, static_cast<int>(stack.size()));
+}
+
+// the register of the value at depth, into which it is loaded first if it is a constant
+uint8_t RegisterCompiler::load(size_t depth)
+{
+    Operand &operand = stack[depth];
+    if (operand.constant) {
+        emitIndex(OP_R_LOAD_CONSTANT, static_cast<uint8_t>(depth), operand.index);
+        operand = Operand{false, static_cast<uint32_t>(depth)};
+    }
+    return static_cast<uint8_t>(depth);
+}
+
+// the operands are appended without looking at the line again, since they share the opcode's
+void RegisterCompiler::emit(OpCode op, std::initializer_list<uint8_t> operands)
+{
+    registers.write(op, line);
+    registers.code.insert(registers.code.end(), operands);
+}
+
+void RegisterCompiler::emitIndex(OpCode op, uint8_t a, uint32_t index)
+{
+    if (index <= MAX_SHORT_OPERAND) {
+        emit(op, {a, static_cast<uint8_t>(index)});
+        return;
+    }
+    // the long form of each of these follows it
+    emit(static_cast<OpCode>(op + 1), {a, static_cast<uint8_t>(index), static_cast<uint8_t>(index >> 8), static_cast<uint8_t>(index >> 16)});
+}
+
+// the register instructions are numbered from OP_R_ADD, so the loop's dispatch table starts there
+static constexpr int FIRST_REGISTER_OP = OP_R_ADD;
+
+template <typename Policy>
+InterpretResult VM::runRegisters(Value *registers)
+{
+    const uint8_t *ip = this->ip;
+    // neither the globals nor the pool grow while the chunk runs
+    Value *globalValues = globals.values();
+    const Value *constants = chunk->constants.values.data();
+
+#define READ_BYTE() (*ip++)
+#define READ_LONG() (ip += 3, static_cast<uint32_t>(ip[-3] | ip[-2] << 8 | ip[-1] << 16))
+#define REGISTER(index) (registers[index])
+#define CONSTANT(index) (constants[index])
+#define STORE_FRAME() (this->ip = ip)
+#define RUNTIME_ERROR(...)              \
+    do {                                \
+        STORE_FRAME();                  \
+        runtimeError(__VA_ARGS__);      \
+        return INTERPRET_RUNTIME_ERROR; \
+    } while (false)
+// A B C, with C a register or, for operandC CONSTANT, a constant
+#define BINARY_OP(valueType, op, operandC)                                                         \
+    do {                                                                                           \
+        uint8_t a = ip[0];                                                                         \
+        Value b = REGISTER(ip[1]);                                                                 \
+        Value c = operandC(ip[2]);                                                                 \
+        ip += 3;                                                                                   \
+        if (!IS_NUMBER(b) || !IS_NUMBER(c)) { RUNTIME_ERROR("Operands must be numbers."); }        \
+        REGISTER(a) = valueType(AS_NUMBER(b) op AS_NUMBER(c));                                     \
+    } while (false)
+// the operands stay in their registers, or the pool, while the result is allocated, so a collection cannot free them
+#define ADD_VALUES(operandC)                                                   \
+    do {                                                                       \
+        uint8_t a = ip[0];                                                     \
+        Value b = REGISTER(ip[1]);                                             \
+        Value c = operandC(ip[2]);                                             \
+        ip += 3;                                                               \
+        if (IS_ANY_STRING(b) && IS_ANY_STRING(c)) {                            \
+            REGISTER(a) = OBJ_VAL(concatenateStrings(*this, AS_OBJ(b), AS_OBJ(c))); \
+        } else if (IS_NUMBER(b) && IS_NUMBER(c)) {                             \
+            REGISTER(a) = NUMBER_VAL(AS_NUMBER(b) + AS_NUMBER(c));             \
+        } else {                                                               \
+            RUNTIME_ERROR("Operand must be two numbers or two strings.");      \
+        }                                                                      \
+    } while (false)
+// comparing a rope flattens it, which allocates; the operands are rooted as above
+#define EQUAL_OP(equal, operandC)                       \
+    do {                                                \
+        uint8_t a = ip[0];                              \
+        Value b = REGISTER(ip[1]);                      \
+        Value c = operandC(ip[2]);                      \
+        ip += 3;                                        \
+        REGISTER(a) = BOOL_VAL(valuesEqual(b, c) == equal); \
+    } while (false)
+#define GET_GLOBAL(a, slot)                                                                                    \
+    do {                                                                                                       \
+        Value value = globalValues[slot];                                                                      \
+        if (IS_UNDEFINED(value)) { RUNTIME_ERROR("Undefined variable '%s'.", globals.name(slot)->getChars()); } \
+        REGISTER(a) = value;                                                                                   \
+    } while (false)
+#define SET_GLOBAL(a, slot)                                                                                                \
+    do {                                                                                                                   \
+        if (IS_UNDEFINED(globalValues[slot])) { RUNTIME_ERROR("Undefined varible: '%s'", globals.name(slot)->getChars()); } \
+        globalValues[slot] = REGISTER(a);                                                                                  \
+    } while (false)
+#define NEGATED_BOOL_VAL(b) BOOL_VAL(!(b))
+// the module runs in a loop of its own, on registers above these; an error in it has already been reported
+#define IMPORT(module)                                      \
+    do {                                                    \
+        STORE_FRAME();                                      \
+        InterpretResult result = runModule<Policy>(module); \
+        if (result != INTERPRET_OK) { return result; }      \
+    } while (false)
+
+#define TRACE_INSTRUCTION()                                 \
+    do {                                                    \
+        if constexpr (Policy::trace) {                      \
+            STORE_FRAME();                                  \
+            traceInstruction(ip, stackTop);                 \
+        }                                                   \
+        if constexpr (Policy::profile) {                    \
+            profiler.record(ip - chunk->code.data());       \
+        }                                                   \
+    } while (false)
+
+#ifdef COMPUTED_GOTO
+    static void *dispatchTable[] = {
+        [OP_R_ADD - FIRST_REGISTER_OP] = &&LABEL_OP_R_ADD,
+        [OP_R_ADD_K - FIRST_REGISTER_OP] = &&LABEL_OP_R_ADD_K,
+        [OP_R_DEFINE_GLOBAL - FIRST_REGISTER_OP] = &&LABEL_OP_R_DEFINE_GLOBAL,
+        [OP_R_DEFINE_GLOBAL_LONG - FIRST_REGISTER_OP] = &&LABEL_OP_R_DEFINE_GLOBAL_LONG,
+        [OP_R_DIVIDE - FIRST_REGISTER_OP] = &&LABEL_OP_R_DIVIDE,
+        [OP_R_DIVIDE_K - FIRST_REGISTER_OP] = &&LABEL_OP_R_DIVIDE_K,
+        [OP_R_EQUAL - FIRST_REGISTER_OP] = &&LABEL_OP_R_EQUAL,
+        [OP_R_EQUAL_K - FIRST_REGISTER_OP] = &&LABEL_OP_R_EQUAL_K,
+        [OP_R_GET_GLOBAL - FIRST_REGISTER_OP] = &&LABEL_OP_R_GET_GLOBAL,
+        [OP_R_GET_GLOBAL_LONG - FIRST_REGISTER_OP] = &&LABEL_OP_R_GET_GLOBAL_LONG,
+        [OP_R_GREATER - FIRST_REGISTER_OP] = &&LABEL_OP_R_GREATER,
+        [OP_R_GREATER_K - FIRST_REGISTER_OP] = &&LABEL_OP_R_GREATER_K,
+        [OP_R_GREATER_EQUAL - FIRST_REGISTER_OP] = &&LABEL_OP_R_GREATER_EQUAL,
+        [OP_R_GREATER_EQUAL_K - FIRST_REGISTER_OP] = &&LABEL_OP_R_GREATER_EQUAL_K,
+        [OP_R_IMPORT - FIRST_REGISTER_OP] = &&LABEL_OP_R_IMPORT,
+        [OP_R_IMPORT_LONG - FIRST_REGISTER_OP] = &&LABEL_OP_R_IMPORT_LONG,
+        [OP_R_LESS - FIRST_REGISTER_OP] = &&LABEL_OP_R_LESS,
+        [OP_R_LESS_K - FIRST_REGISTER_OP] = &&LABEL_OP_R_LESS_K,
+        [OP_R_LESS_EQUAL - FIRST_REGISTER_OP] = &&LABEL_OP_R_LESS_EQUAL,
+        [OP_R_LESS_EQUAL_K - FIRST_REGISTER_OP] = &&LABEL_OP_R_LESS_EQUAL_K,
+        [OP_R_LOAD_CONSTANT - FIRST_REGISTER_OP] = &&LABEL_OP_R_LOAD_CONSTANT,
+        [OP_R_LOAD_CONSTANT_LONG - FIRST_REGISTER_OP] = &&LABEL_OP_R_LOAD_CONSTANT_LONG,
+        [OP_R_MULTIPLY - FIRST_REGISTER_OP] = &&LABEL_OP_R_MULTIPLY,
+        [OP_R_MULTIPLY_K - FIRST_REGISTER_OP] = &&LABEL_OP_R_MULTIPLY_K,
+        [OP_R_NEGATE - FIRST_REGISTER_OP] = &&LABEL_OP_R_NEGATE,
+        [OP_R_NOT - FIRST_REGISTER_OP] = &&LABEL_OP_R_NOT,
+        [OP_R_NOT_EQUAL - FIRST_REGISTER_OP] = &&LABEL_OP_R_NOT_EQUAL,
+        [OP_R_NOT_EQUAL_K - FIRST_REGISTER_OP] = &&LABEL_OP_R_NOT_EQUAL_K,
+        [OP_R_PRINT - FIRST_REGISTER_OP] = &&LABEL_OP_R_PRINT,
+        [OP_R_RETURN - FIRST_REGISTER_OP] = &&LABEL_OP_R_RETURN,
+        [OP_R_SET_GLOBAL - FIRST_REGISTER_OP] = &&LABEL_OP_R_SET_GLOBAL,
+        [OP_R_SET_GLOBAL_LONG - FIRST_REGISTER_OP] = &&LABEL_OP_R_SET_GLOBAL_LONG,
+        [OP_R_SUBTRACT - FIRST_REGISTER_OP] = &&LABEL_OP_R_SUBTRACT,
+        [OP_R_SUBTRACT_K - FIRST_REGISTER_OP] = &&LABEL_OP_R_SUBTRACT_K,
+    };
+#define CASE(opcode) \
+    case opcode:     \
+        LABEL_##opcode:
+#define DISPATCH()                                            \
+    do {                                                      \
+        TRACE_INSTRUCTION();                                  \
+        goto *dispatchTable[READ_BYTE() - FIRST_REGISTER_OP]; \
+    } while (false)
+#else
+#define CASE(opcode) case opcode:
+#define DISPATCH() continue
+#endif
+
+    for (;;) {
+        TRACE_INSTRUCTION();
+        switch (READ_BYTE()) {
+        CASE(OP_R_ADD) {
+            ADD_VALUES(REGISTER);
+            DISPATCH();
+        }
+        CASE(OP_R_ADD_K) {
+            ADD_VALUES(CONSTANT);
+            DISPATCH();
+        }
+        CASE(OP_R_DEFINE_GLOBAL) {
+            uint8_t a = READ_BYTE();
+            globalValues[READ_BYTE()] = REGISTER(a);
+            DISPATCH();
+        }
+        CASE(OP_R_DEFINE_GLOBAL_LONG) {
+            uint8_t a = READ_BYTE();
+            globalValues[READ_LONG()] = REGISTER(a);
+            DISPATCH();
+        }
+        CASE(OP_R_DIVIDE) {
+            BINARY_OP(NUMBER_VAL, /, REGISTER);
+            DISPATCH();
+        }
+        CASE(OP_R_DIVIDE_K) {
+            BINARY_OP(NUMBER_VAL, /, CONSTANT);
+            DISPATCH();
+        }
+        CASE(OP_R_EQUAL) {
+            EQUAL_OP(true, REGISTER);
+            DISPATCH();
+        }
+        CASE(OP_R_EQUAL_K) {
+            EQUAL_OP(true, CONSTANT);
+            DISPATCH();
+        }
+        CASE(OP_R_GET_GLOBAL) {
+            uint8_t a = READ_BYTE();
+            uint8_t slot = READ_BYTE();
+            GET_GLOBAL(a, slot);
+            DISPATCH();
+        }
+        CASE(OP_R_GET_GLOBAL_LONG) {
+            uint8_t a = READ_BYTE();
+            uint32_t slot = READ_LONG();
+            GET_GLOBAL(a, slot);
+            DISPATCH();
+        }
+        CASE(OP_R_GREATER) {
+            BINARY_OP(BOOL_VAL, >, REGISTER);
+            DISPATCH();
+        }
+        CASE(OP_R_GREATER_K) {
+            BINARY_OP(BOOL_VAL, >, CONSTANT);
+            DISPATCH();
+        }
+        CASE(OP_R_GREATER_EQUAL) {
+            // !(a < b), as OP_GREATER_EQUAL computes it
+            BINARY_OP(NEGATED_BOOL_VAL, <, REGISTER);
+            DISPATCH();
+        }
+        CASE(OP_R_GREATER_EQUAL_K) {
+            BINARY_OP(NEGATED_BOOL_VAL, <, CONSTANT);
+            DISPATCH();
+        }
+        CASE(OP_R_IMPORT) {
+            uint8_t module = READ_BYTE();
+            IMPORT(module);
+            DISPATCH();
+        }
+        CASE(OP_R_IMPORT_LONG) {
+            uint32_t module = READ_LONG();
+            IMPORT(module);
+            DISPATCH();
+        }
+        CASE(OP_R_LESS) {
+            BINARY_OP(BOOL_VAL, <, REGISTER);
+            DISPATCH();
+        }
+        CASE(OP_R_LESS_K) {
+            BINARY_OP(BOOL_VAL, <, CONSTANT);
+            DISPATCH();
+        }
+        CASE(OP_R_LESS_EQUAL) {
+            BINARY_OP(NEGATED_BOOL_VAL, >, REGISTER);
+            DISPATCH();
+        }
+        CASE(OP_R_LESS_EQUAL_K) {
+            BINARY_OP(NEGATED_BOOL_VAL, >, CONSTANT);
+            DISPATCH();
+        }
+        CASE(OP_R_LOAD_CONSTANT) {
+            uint8_t a = READ_BYTE();
+            REGISTER(a) = CONSTANT(READ_BYTE());
+            DISPATCH();
+        }
+        CASE(OP_R_LOAD_CONSTANT_LONG) {
+            uint8_t a = READ_BYTE();
+            REGISTER(a) = CONSTANT(READ_LONG());
+            DISPATCH();
+        }
+        CASE(OP_R_MULTIPLY) {
+            BINARY_OP(NUMBER_VAL, *, REGISTER);
+            DISPATCH();
+        }
+        CASE(OP_R_MULTIPLY_K) {
+            BINARY_OP(NUMBER_VAL, *, CONSTANT);
+            DISPATCH();
+        }
+        CASE(OP_R_NEGATE) {
+            uint8_t a = READ_BYTE();
+            Value b = REGISTER(READ_BYTE());
+            if (!IS_NUMBER(b)) { RUNTIME_ERROR("Operand must be a number."); }
+            REGISTER(a) = NUMBER_VAL(-AS_NUMBER(b));
+            DISPATCH();
+        }
+        CASE(OP_R_NOT) {
+            uint8_t a = READ_BYTE();
+            REGISTER(a) = BOOL_VAL(isFalsey(REGISTER(READ_BYTE())));
+            DISPATCH();
+        }
+        CASE(OP_R_NOT_EQUAL) {
+            EQUAL_OP(false, REGISTER);
+            DISPATCH();
+        }
+        CASE(OP_R_NOT_EQUAL_K) {
+            EQUAL_OP(false, CONSTANT);
+            DISPATCH();
+        }
+        CASE(OP_R_PRINT) {
+            printValue(REGISTER(READ_BYTE()));
+            printf("\n");
+            DISPATCH();
+        }
+        CASE(OP_R_RETURN) {
+            STORE_FRAME();
+            return INTERPRET_OK;
+        }
+        CASE(OP_R_SET_GLOBAL) {
+            uint8_t a = READ_BYTE();
+            uint8_t slot = READ_BYTE();
+            SET_GLOBAL(a, slot);
+            DISPATCH();
+        }
+        CASE(OP_R_SET_GLOBAL_LONG) {
+            uint8_t a = READ_BYTE();
+            uint32_t slot = READ_LONG();
+            SET_GLOBAL(a, slot);
+            DISPATCH();
+        }
+        CASE(OP_R_SUBTRACT) {
+            BINARY_OP(NUMBER_VAL, -, REGISTER);
+            DISPATCH();
+        }
+        CASE(OP_R_SUBTRACT_K) {
+            BINARY_OP(NUMBER_VAL, -, CONSTANT);
+            DISPATCH();
+        }
+        }
+    }
+#undef READ_BYTE
+#undef READ_LONG
+#undef REGISTER
+#undef CONSTANT
+#undef STORE_FRAME
+#undef RUNTIME_ERROR
+#undef BINARY_OP
+#undef ADD_VALUES
+#undef EQUAL_OP
+#undef GET_GLOBAL
+#undef SET_GLOBAL
+#undef NEGATED_BOOL_VAL
+#undef IMPORT
+#undef TRACE_INSTRUCTION
+#undef CASE
+#undef DISPATCH
+}
+
+template InterpretResult VM::runRegisters<Untraced>(Value *registers);
+template InterpretResult VM::runRegisters<Traced>(Value *registers);
+template InterpretResult VM::runRegisters<Profiled>(Value *registers);
@@ -0,0 +1,62 @@
+#ifndef CXXLOX_REGISTER_H
+#define CXXLOX_REGISTER_H
+
+#include <initializer_list>
+#include <vector>
+
+#include "chunk.h"
+
+// Translates a finished chunk of stack code into register code for VM::runRegisters(), selected with --register-vm.
+//
+// The stack the code would build at run time is simulated, and the value at each depth is kept in the register of that
+// number, so an instruction names its operands and result instead of pushing and popping them: OP_R_ADD A B C sets
+// register A to the sum of registers B and C. Constants are not loaded into a register until an instruction needs
+// one there: the *_K forms take a constant as their last operand, so a * 2 + 1 is
+//
+//     OP_R_GET_GLOBAL  r0    0 'a'
+//     OP_R_MULTIPLY_K  r0 r0    1 '2'
+//     OP_R_ADD_K       r0 r0    2 '1'
+//
+// where the stack code needs five instructions. Register operands are one byte; constant operands are one byte in the
+// *_K forms and one or three in OP_R_LOAD_CONSTANT(_LONG), and global slots one or three as in the stack code.
+//
+// Every instruction keeps the line of the stack instruction it was translated from, and the operands are evaluated
+// and checked in the same order, so the register code reports the same runtime errors as the stack code.
+class RegisterCompiler
+{
+public:
+    // registerCount, the number of registers the code uses, is at most maxRegisters
+    RegisterCompiler(const Chunk &code, Chunk &registers, int maxRegisters) : code(code), registers(registers), maxRegisters(maxRegisters) {}
+
+    // false if the code needs more registers than maxRegisters; it then has to run as stack code
+    bool compile();
+
+    int getRegisterCount() const { return registerCount; }
+
+private:
+    // a value on the simulated stack: in the register of its depth, or a constant not loaded yet
+    struct Operand
+    {
+        bool constant;
+        uint32_t index;  // the constant's
+    };
+
+    const Chunk &code;
+    Chunk &registers;
+    int maxRegisters;
+    int registerCount = 0;
+    uint32_t nilConstant = 0;  // true and false follow it
+    std::vector<Operand> stack;
+    unsigned line = 0;
+    bool overflowed = false;
+
+    void translate(OpCode op, uint32_t operand);
+    void binary(OpCode registerOp, OpCode constantOp, OpCode swappedOp);
+
+    void push(Operand operand);
+    uint8_t load(size_t depth);
+    void emit(OpCode op, std::initializer_list<uint8_t> operands);
+    // op with register a and a constant index or global slot, in the short or the long form
+    void emitIndex(OpCode op, uint8_t a, uint32_t index);
+};
+#endif
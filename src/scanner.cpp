@@ -1,9 +1,60 @@
 #include "scanner.h"
 
+#include <bit>
+#include <charconv>
+#include <cstdlib>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 static inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
 
 static bool isAlpha(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; }
 
+static inline bool isBlank(char c) { return c == ' ' || c == '\r' || c == '\t' || c == '\n'; }
+
+// Most runs of blanks, string bodies and identifiers are a few bytes long, so they are scanned one byte at a time up to
+// this length, and only past it a block at a time.
+static constexpr int SHORT_RUN = 8;
+
+#ifdef __SSE2__
+// Runs of blanks, comments, string bodies and identifiers are skipped a block of 16 bytes at a time: each byte of the
+// block is classified at once into a bit mask, whose trailing bits give the length of the run.
+static constexpr int BLOCK = 16;
+
+static inline __m128i loadBlock(const char *p) { return _mm_loadu_si128(reinterpret_cast<const __m128i *>(p)); }
+
+// bit i is set if byte i of the block is c
+static inline uint32_t bytesEqual(__m128i block, char c) { return _mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8(c))); }
+
+// bit i is set if byte i of the block is in [low, high]; the comparisons are signed, so bytes above 0x7f never are
+static inline uint32_t bytesBetween(__m128i block, char low, char high)
+{
+    __m128i above = _mm_cmpgt_epi8(block, _mm_set1_epi8(static_cast<char>(low - 1)));
+    __m128i below = _mm_cmplt_epi8(block, _mm_set1_epi8(static_cast<char>(high + 1)));
+    return _mm_movemask_epi8(_mm_and_si128(above, below));
+}
+
+static inline uint32_t identifierBytes(__m128i block)
+{
+    // setting bit 5 maps 'A'-'Z' onto 'a'-'z' and nothing else onto them
+    __m128i lower = _mm_or_si128(block, _mm_set1_epi8(0x20));
+    return bytesBetween(lower, 'a', 'z') | bytesBetween(block, '0', '9') | bytesEqual(block, '_');
+}
+
+// the bits below the first n
+static inline uint32_t lowBits(unsigned n) { return (1u << n) - 1; }
+
+// a run seldom has more than one newline, and without -mpopcnt countBits() is a library call
+static inline unsigned countBits(uint32_t bits)
+{
+    unsigned count = 0;
+    for (; bits != 0; bits &= bits - 1) { ++count; }
+    return count;
+}
+#endif
+
 Token Scanner::scanToken()
 {
     skipWhitespace();
@@ -22,7 +73,7 @@ Token Scanner::scanToken()
     case '{':
         return makeToken(TOKEN_LEFT_BRACE);
     case '}':
-        return makeToken(TOKEN_LEFT_BRACE);
+        return makeToken(TOKEN_RIGHT_BRACE);
     case ';':
         return makeToken(TOKEN_SEMICOLON);
     case ',':
@@ -61,114 +112,193 @@ bool Scanner::match(char expected)
 
 void Scanner::skipWhitespace()
 {
-    for (;;) {
-        char c = peek();
-        switch (c) {
+    for (int blanks = 0;; ++blanks) {
+        switch (peek()) {
+        case '\n':
+            ++line;
+            [[fallthrough]];
         case ' ':
         case '\r':
         case '\t':
             advance();
-            break;
-        case '\n':
-            ++line;
-            advance();
+            if (blanks == SHORT_RUN) { skipBlanks(); }
             break;
         case '/':
-            if (peekNext() == '/') {
-                while (peek() != '\n' && !isAtEnd()) advance();
-            } else {
-                return;
-            }
+            if (peekNext() != '/') { return; }
+            skipComment();
+            break;
         default:
             return;
         }
     }
 }
 
+// skips the rest of a long run of spaces, tabs, carriage returns and newlines, counting the newlines
+void Scanner::skipBlanks()
+{
+#ifdef __SSE2__
+    while (end - current >= BLOCK) {
+        __m128i block = loadBlock(current);
+        uint32_t newlines = bytesEqual(block, '\n');
+        uint32_t blanks = newlines | bytesEqual(block, ' ') | bytesEqual(block, '\t') | bytesEqual(block, '\r');
+        unsigned length = std::countr_one(blanks);
+        line += countBits(newlines & lowBits(length));
+        current += length;
+        if (length != BLOCK) { return; }
+    }
+#endif
+    while (isBlank(peek())) {
+        if (peek() == '\n') { ++line; }
+        advance();
+    }
+}
+
+// skips a comment up to the newline that ends it, which is left for skipBlanks() to count
+void Scanner::skipComment()
+{
+#ifdef __SSE2__
+    while (end - current >= BLOCK) {
+        __m128i block = loadBlock(current);
+        uint32_t stops = bytesEqual(block, '\n') | bytesEqual(block, '\0');
+        if (stops != 0) {
+            current += std::countr_zero(stops);
+            return;
+        }
+        current += BLOCK;
+    }
+#endif
+    while (peek() != '\n' && !isAtEnd()) { advance(); }
+}
+
 Token Scanner::string()
 {
+    for (int i = 0; i != SHORT_RUN && peek() != '"' && !isAtEnd(); ++i) {
+        if (peek() == '\n') { ++line; }
+        advance();
+    }
+#ifdef __SSE2__
+    while (end - current >= BLOCK && peek() != '"') {
+        __m128i block = loadBlock(current);
+        uint32_t newlines = bytesEqual(block, '\n');
+        uint32_t stops = bytesEqual(block, '"') | bytesEqual(block, '\0');
+        unsigned length = stops != 0 ? std::countr_zero(stops) : BLOCK;
+        line += countBits(newlines & lowBits(length));
+        current += length;
+        if (length != BLOCK) { break; }
+    }
+#endif
     while (peek() != '"' && !isAtEnd()) {
         if (peek() == '\n') { ++line; }
         advance();
     }
 
-    if (isAtEnd()) { return errorToken("Unterminated string.l"); }
+    if (isAtEnd()) { return errorToken("Unterminated string."); }
 
     advance();
     return makeToken(TOKEN_STRING);
 }
 
+// Digits are accumulated while they are scanned. Up to MAX_EXACT_DIGITS of them form an integer that a double holds
+// exactly, and dividing it by an exactly representable power of ten rounds correctly; longer literals, which are
+// rare, are left to from_chars.
+static constexpr int MAX_EXACT_DIGITS = 15;
+static constexpr double EXACT_POWERS_OF_TEN[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15};
+
 Token Scanner::number()
 {
-    while (isDigit(peek())) advance();
+    uint64_t digits = start[0] - '0';
+    int digitCount = 1;
+    for (; isDigit(peek()); ++digitCount) { digits = digits * 10 + (advance() - '0'); }
 
+    int fractionDigits = 0;
     if (peek() == '.' && isDigit(peekNext())) {
         advance();
-        while (isDigit(peek())) advance();
+        for (; isDigit(peek()); ++fractionDigits) { digits = digits * 10 + (advance() - '0'); }
     }
 
-    return makeToken(TOKEN_NUMBER);
+    Token token = makeToken(TOKEN_NUMBER);
+    if (digitCount + fractionDigits <= MAX_EXACT_DIGITS) {
+        token.number = static_cast<double>(digits) / EXACT_POWERS_OF_TEN[fractionDigits];
+    } else if (std::from_chars(start, current, token.number).ec != std::errc()) {
+        // from_chars leaves the value alone if it does not fit a double, where strtod() returns infinity or zero
+        token.number = strtod(start, nullptr);
+    }
+    return token;
 }
 
-TokenType Scanner::identiferType()
-{
-    switch (start[0]) {
-    case 'a':
-        return checkKeyword(1, 2, "nd", TOKEN_AND);
-    case 'c':
-        return checkKeyword(1, 4, "lass", TOKEN_CLASS);
-    case 'e':
-        return checkKeyword(1, 3, "lse", TOKEN_ELSE);
-    case 'f':
-        if (current - start > 1) {
-            switch (start[1]) {
-            case 'a':
-                return checkKeyword(2, 3, "lse", TOKEN_FALSE);
-            case 'o':
-                return checkKeyword(2, 1, "r", TOKEN_FOR);
-            case 'u':
-                return checkKeyword(2, 1, "n", TOKEN_FUN);
-            }
-        }
-        break;
-    case 'i':
-        return checkKeyword(1, 1, "f", TOKEN_IF);
-    case 'n':
-        return checkKeyword(1, 2, "il", TOKEN_NIL);
-    case 'o':
-        return checkKeyword(1, 1, "r", TOKEN_OR);
-    case 'p':
-        return checkKeyword(1, 4, "rint", TOKEN_PRINT);
-    case 'r':
-        return checkKeyword(1, 5, "eturn", TOKEN_RETURN);
-    case 's':
-        return checkKeyword(1, 4, "uper", TOKEN_SUPER);
-    case 't':
-        if (current - start > 1) {
-            switch (start[1]) {
-            case 'h':
-                return checkKeyword(2, 2, "is", TOKEN_THIS);
-            case 'r':
-                return checkKeyword(2, 2, "ue", TOKEN_TRUE);
-            }
-        }
-        break;
-    case 'v':
-        return checkKeyword(1, 2, "ar", TOKEN_VAR);
-    case 'w':
-        return checkKeyword(1, 4, "hile", TOKEN_WHILE);
+// The keywords are told apart by a hash of their first two characters and length that is perfect for them, so an
+// identifier is compared with at most one keyword.
+struct Keyword
+{
+    const char *name;
+    int length;
+    TokenType type;
+};
+
+static constexpr Keyword KEYWORDS[] = {
+    {"and", 3, TOKEN_AND}, {"class", 5, TOKEN_CLASS}, {"else", 4, TOKEN_ELSE}, {"false", 5, TOKEN_FALSE},
+    {"for", 3, TOKEN_FOR}, {"fun", 3, TOKEN_FUN}, {"if", 2, TOKEN_IF}, {"import", 6, TOKEN_IMPORT},
+    {"nil", 3, TOKEN_NIL}, {"or", 2, TOKEN_OR}, {"print", 5, TOKEN_PRINT}, {"return", 6, TOKEN_RETURN},
+    {"super", 5, TOKEN_SUPER}, {"this", 4, TOKEN_THIS}, {"true", 4, TOKEN_TRUE}, {"var", 3, TOKEN_VAR},
+    {"while", 5, TOKEN_WHILE},
+};
+
+static constexpr int MIN_KEYWORD_LENGTH = 2;
+static constexpr int MAX_KEYWORD_LENGTH = 6;
+static constexpr unsigned KEYWORD_SLOTS = 32;
+
+static constexpr unsigned keywordHash(const char *chars, int length)
+{
+    return (static_cast<unsigned char>(chars[0]) * 9u + static_cast<unsigned char>(chars[1]) * 2u + length * 2u) & (KEYWORD_SLOTS - 1);
+}
+
+struct KeywordTable
+{
+    // a slot without a keyword has length 0
+    Keyword slots[KEYWORD_SLOTS] = {};
+    bool perfect = true;
+};
+
+static constexpr KeywordTable makeKeywordTable()
+{
+    KeywordTable table;
+    for (const Keyword &keyword : KEYWORDS) {
+        Keyword &slot = table.slots[keywordHash(keyword.name, keyword.length)];
+        if (slot.length != 0) { table.perfect = false; }
+        slot = keyword;
     }
-    return TOKEN_IDENTIFIER;
+    return table;
 }
 
-TokenType Scanner::checkKeyword(int start, int length, const char *rest, TokenType type)
+static constexpr KeywordTable KEYWORD_TABLE = makeKeywordTable();
+static_assert(KEYWORD_TABLE.perfect, "two keywords share a slot; change the multipliers in keywordHash()");
+
+TokenType Scanner::identifierType()
 {
-    if (current - this->start == start + length && memcmp(this->start + start, rest, length) == 0) { return type; }
-    return TOKEN_IDENTIFIER;
+    int length = static_cast<int>(current - start);
+    if (length < MIN_KEYWORD_LENGTH || length > MAX_KEYWORD_LENGTH) { return TOKEN_IDENTIFIER; }
+    const Keyword &keyword = KEYWORD_TABLE.slots[keywordHash(start, length)];
+    if (keyword.length != length) { return TOKEN_IDENTIFIER; }
+    // short enough that calling memcmp() would cost more than the comparison
+    for (int i = 0; i != length; ++i) {
+        if (start[i] != keyword.name[i]) { return TOKEN_IDENTIFIER; }
+    }
+    return keyword.type;
 }
 
 Token Scanner::identifier()
 {
+    for (int i = 0; i != SHORT_RUN; ++i) {
+        if (!isAlpha(peek()) && !isDigit(peek())) { return makeToken(identifierType()); }
+        advance();
+    }
+#ifdef __SSE2__
+    while (end - current >= BLOCK) {
+        unsigned length = std::countr_one(identifierBytes(loadBlock(current)));
+        current += length;
+        if (length != BLOCK) { return makeToken(identifierType()); }
+    }
+#endif
     while (isAlpha(peek()) || isDigit(peek())) advance();
-    return makeToken(identiferType());
+    return makeToken(identifierType());
 }
@@ -2,7 +2,7 @@
 #define CXXLOX_SCANNER_H
 
 #include <cstring>
-#include <string>
+#include <string_view>
 
 enum TokenType
 {
@@ -42,6 +42,7 @@ enum TokenType
     TOKEN_FOR,
     TOKEN_FUN,
     TOKEN_IF,
+    TOKEN_IMPORT,
     TOKEN_NIL,
     TOKEN_OR,
     TOKEN_PRINT,
@@ -61,6 +62,8 @@ struct Token
     const char *start;
     int length;
     int line;
+    // the value of a TOKEN_NUMBER, parsed while it is scanned
+    double number = 0;
 
     Token() = default;
 
@@ -72,12 +75,15 @@ class Scanner
     friend struct Token;
 
 public:
-    Scanner(const std::string &source) : source(source.c_str()), start(this->source), current(this->source) {}
+    // the text is scanned up to the first '\0', and there must be one at source[source.size()]
+    Scanner(std::string_view source) : source(source.data()), end(this->source + source.size()), start(this->source), current(this->source) {}
 
     Token scanToken();
 
 private:
     const char *source;
+    // the terminating '\0'; the block-wise loops only read whole blocks that end before it
+    const char *end;
     const char *start;
     const char *current;
     unsigned line = 1;
@@ -86,7 +92,6 @@ private:
 
     Token makeToken(TokenType type) { return Token(type, start, static_cast<int>(current - start), line); }
 
-
     Token errorToken(const char *message) { return Token(TOKEN_ERROR, message, static_cast<int>(strlen(message)), line); }
 
     char advance() { return *current++; }
@@ -98,13 +103,14 @@ private:
     bool match(char expected);
 
     void skipWhitespace();
+    void skipBlanks();
+    void skipComment();
 
     Token string();
     Token number();
     Token identifier();
 
-    TokenType identiferType();
-    TokenType checkKeyword(int start, int length, const char *rest, TokenType type);
+    TokenType identifierType();
 };
 
 #endif
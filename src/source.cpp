@@ -0,0 +1,61 @@
+#include "source.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+SourceFile::~SourceFile()
+{
+    if (mapping != nullptr) { munmap(mapping, mappingSize); }
+}
+
+bool SourceFile::open(const char *path)
+{
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) { return false; }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+    if (!S_ISREG(st.st_mode)) {
+        bool loaded = read(fd);
+        close(fd);
+        return loaded;
+    }
+
+    size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t fileSize = static_cast<size_t>(st.st_size);
+    mappingSize = (fileSize / pageSize + 1) * pageSize;
+    mapping = mmap(nullptr, mappingSize, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        mapping = nullptr;
+        close(fd);
+        return false;
+    }
+    if (fileSize != 0 && mmap(mapping, fileSize, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    close(fd);
+    // the scanner reads the text once from front to back
+    madvise(mapping, fileSize, MADV_SEQUENTIAL);
+    data = static_cast<const char *>(mapping);
+    size = fileSize;
+    return true;
+}
+
+bool SourceFile::read(int fd)
+{
+    char chunk[64 * 1024];
+    for (;;) {
+        ssize_t count = ::read(fd, chunk, sizeof chunk);
+        if (count < 0) { return false; }
+        if (count == 0) { break; }
+        buffer.append(chunk, count);
+    }
+    data = buffer.c_str();
+    size = buffer.size();
+    return true;
+}
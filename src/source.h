@@ -0,0 +1,33 @@
+#ifndef CXXLOX_SOURCE_H
+#define CXXLOX_SOURCE_H
+
+#include <string>
+#include <string_view>
+
+// The text of a script, mapped read-only so that it is scanned where it lies instead of being copied first. The
+// mapping is placed over anonymous zero pages reserved a page beyond the file, so the text is always followed by the
+// '\0' the scanner stops at, even when the file ends on a page boundary. Files that can not be mapped, like pipes, are
+// read into a buffer instead.
+class SourceFile
+{
+public:
+    SourceFile() = default;
+    SourceFile(const SourceFile &) = delete;
+    SourceFile &operator=(const SourceFile &) = delete;
+    ~SourceFile();
+
+    // returns false if the file can not be read
+    bool open(const char *path);
+
+    std::string_view text() const { return std::string_view(data, size); }
+
+private:
+    const char *data = "";
+    size_t size = 0;
+    void *mapping = nullptr;
+    size_t mappingSize = 0;
+    std::string buffer;
+
+    bool read(int fd);
+};
+#endif
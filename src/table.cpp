@@ -29,13 +29,57 @@ bool Table::delete_(ObjString *key)
 }
 
 
-ObjString *Table::findString(const char *chars, int length, uint32_t hash)
+void Table::addAll(Table *from, Table *to) { to->map.insert(from->map.cbegin(), from->map.cend()); }
+
+int Globals::slot(ObjString *name)
+{
+    Value slot;
+    if (slots.get(name, &slot)) { return static_cast<int>(AS_NUMBER(slot)); }
+    int index = static_cast<int>(names.size());
+    slots.set(name, NUMBER_VAL(static_cast<double>(index)));
+    names.push_back(name);
+    slotValues.push_back(UNDEFINED_VAL);
+    return index;
+}
+
+void StringTable::add(ObjString *string)
+{
+    if (count + 1 > entries.size() * MAX_LOAD) { adjustCapacity(entries.empty() ? 8 : entries.size() * 2); }
+    size_t mask = entries.size() - 1;
+    size_t index = string->getHash() & mask;
+    while (entries[index] != nullptr) { index = (index + 1) & mask; }
+    entries[index] = string;
+    ++count;
+}
+
+ObjString *StringTable::findString(const char *chars, int length, uint32_t hash) const
 {
-    if (map.empty()) { return nullptr; }
-    for (const auto &p : map) {
-        if (p.first->equals(chars, length, hash)) { return p.first; }
+    if (count == 0) { return nullptr; }
+    size_t mask = entries.size() - 1;
+    for (size_t index = hash & mask;; index = (index + 1) & mask) {
+        ObjString *string = entries[index];
+        if (string == nullptr) { return nullptr; }
+        if (string->equals(chars, length, hash)) { return string; }
     }
-    return nullptr;
 }
 
-void Table::addAll(Table *from, Table *to) { to->map.insert(from->map.cbegin(), from->map.cend()); }
+void StringTable::removeUnmarked()
+{
+    // deleting from a linear-probing table would need tombstones, so the survivors are simply reinserted
+    std::vector<ObjString *> old(entries.size(), nullptr);
+    old.swap(entries);
+    count = 0;
+    for (ObjString *string : old) {
+        if (string != nullptr && string->isMarked()) { add(string); }
+    }
+}
+
+void StringTable::adjustCapacity(size_t capacity)
+{
+    std::vector<ObjString *> old(capacity, nullptr);
+    old.swap(entries);
+    count = 0;
+    for (ObjString *string : old) {
+        if (string != nullptr) { add(string); }
+    }
+}
@@ -1,4 +1,8 @@
+#ifndef CXXLOX_TABLE_H
+#define CXXLOX_TABLE_H
+
 #include <unordered_map>
+#include <vector>
 
 #include "object.h"
 #include "value.h"
@@ -9,10 +13,48 @@ public:
     bool get(ObjString *key, Value *value);
     bool set(ObjString *key, Value value);
     bool delete_(ObjString *key);
-    ObjString *findString(const char *chars, int length, uint32_t hash);
     void addAll(Table *from, Table *to);
 
 private:
     // Value of Obj type will be freed by VM dtor
     std::unordered_map<ObjString *, Value> map;
 };
+
+// Global variables, resolved by name to slots when they are compiled and accessed by slot when they are executed.
+// A slot holds UNDEFINED_VAL until its variable is defined.
+class Globals
+{
+    friend class VM;
+
+public:
+    int slot(ObjString *name);
+    ObjString *name(int slot) const { return names[slot]; }
+    int count() const { return static_cast<int>(names.size()); }
+    Value *values() { return slotValues.data(); }
+
+private:
+    Table slots;
+    std::vector<ObjString *> names;
+    std::vector<Value> slotValues;
+};
+
+// Set of interned strings, open-addressed and probed by the hash each ObjString already carries,
+// so a lookup by content touches only the strings that share its probe sequence.
+class StringTable
+{
+public:
+    void add(ObjString *string);
+    ObjString *findString(const char *chars, int length, uint32_t hash) const;
+    // the table holds its strings weakly: the collector calls this before sweeping so no entry dangles
+    void removeUnmarked();
+
+private:
+    static constexpr double MAX_LOAD = 0.75;
+
+    // nullptr marks an empty bucket; the capacity is always zero or a power of two
+    std::vector<ObjString *> entries;
+    size_t count = 0;
+
+    void adjustCapacity(size_t capacity);
+};
+#endif
@@ -0,0 +1,271 @@
+#include "transpiler.h"
+
+#include <cmath>
+
+#include "object.h"
+#include "vm.h"
+
+void Transpiler::emit(FILE *out)
+{
+    this->out = out;
+    fprintf(out, "// translated by cxxlox --emit-cpp; build it against the runtime with `make native`\n");
+    fprintf(out, "#include \"native.h\"\n\nnamespace {\n\n");
+
+    // the script is chunk 0, and module i is chunk i + 1
+    emitChunk(0, chunk);
+    for (size_t i = 0; i != vm.modules.size(); ++i) { emitChunk(i + 1, vm.modules[i].chunk); }
+
+    const Globals &globals = vm.globals;
+    if (globals.count() != 0) {
+        fprintf(out, "const char *const globalNames[] = {\n");
+        for (int slot = 0; slot != globals.count(); ++slot) {
+            fprintf(out, "    ");
+            emitString(globals.name(slot)->getChars(), globals.name(slot)->getLength());
+            fprintf(out, ",\n");
+        }
+        fprintf(out, "};\n\n");
+    }
+
+    fprintf(out, "const NativeChunk chunks[] = {\n");
+    for (size_t i = 0; i <= vm.modules.size(); ++i) {
+        fprintf(out, "    {");
+        if (i == 0) {
+            fprintf(out, "nullptr");
+        } else {
+            emitString(vm.modules[i - 1].path.data(), static_cast<int>(vm.modules[i - 1].path.size()));
+        }
+        size_t constants = (i == 0 ? chunk : vm.modules[i - 1].chunk).constants.values.size();
+        if (constants == 0) {
+            fprintf(out, ", nullptr, 0, chunk%zu},\n", i);
+        } else {
+            fprintf(out, ", constants%zu, %zu, chunk%zu},\n", i, constants, i);
+        }
+    }
+    fprintf(out, "};\n\n}  // namespace\n\n");
+
+    fprintf(out, "int main()\n{\n");
+    fprintf(out, "    return NativeRuntime::main(NativeProgram{%s, %d, chunks, %zu});\n", globals.count() != 0 ? "globalNames" : "nullptr",
+            globals.count(), vm.modules.size() + 1);
+    fprintf(out, "}\n");
+}
+
+// the functions of chunk index are chunk<index>_<part>, and chunk<index> calls them in order
+void Transpiler::emitChunk(size_t index, const Chunk &code)
+{
+    this->code = &code;
+    emitConstants(index, code);
+
+    size_t parts = 0;
+    size_t instructions = 0;
+    unsigned lastLine = 0;
+    depth = 0;
+    for (size_t offset = 0; offset < code.code.size();) {
+        if (instructions == 0) {
+            fprintf(out, "[[gnu::noinline]] bool chunk%zu_%zu(NativeRuntime &runtime, Value *stack)\n{\n", index, parts);
+            fprintf(out, "    [[maybe_unused]] Value *globals = runtime.globals();\n");
+            fprintf(out, "    [[maybe_unused]] const Value *constants = runtime.constants(%zu);\n", index);
+            lastLine = 0;
+        }
+
+        OpCode op = genericForm(static_cast<OpCode>(code.code[offset]));
+        unsigned line = code.getLine(offset);
+        if (line != lastLine) {
+            fprintf(out, "    // line %u\n", line);
+            lastLine = line;
+        }
+        const Superinstruction *super = findSuperinstruction(op);
+        if (super == nullptr) {
+            int size = operandSize(op);
+            translate(op, size == 0 ? 0 : size == 1 ? code.code[offset + 1] : code.readOperand(offset), line);
+            offset += 1 + size;
+        } else {
+            // the parts one by one, each with its one byte operand; all of them report errors against the line of the
+            // superinstruction
+            const uint8_t *operand = &code.code[offset + 1];
+            for (int i = 0; i != super->length; ++i) {
+                OpCode part = super->parts[i];
+                translate(part, operandSize(part) != 0 ? *operand++ : 0, line);
+            }
+            offset = operand - code.code.data();
+        }
+
+        // OP_RETURN has returned already
+        bool last = offset >= code.code.size();
+        if (last || (++instructions >= PART_INSTRUCTIONS && depth == 0)) {
+            if (!last || op != OP_RETURN) { fprintf(out, "    return true;\n"); }
+            fprintf(out, "}\n\n");
+            instructions = 0;
+            ++parts;
+        }
+    }
+
+    fprintf(out, "bool chunk%zu(NativeRuntime &runtime, Value *stack)\n{\n", index);
+    for (size_t part = 0; part != parts; ++part) {
+        fprintf(out, "    if (!chunk%zu_%zu(runtime, stack)) { return false; }\n", index, part);
+    }
+    fprintf(out, "    return true;\n}\n\n");
+}
+
+// every constant is described, so that the indices of the pool stay the same, but only strings are read from it; the
+// code has the others written into it
+void Transpiler::emitConstants(size_t index, const Chunk &code)
+{
+    const std::vector<Value> &values = code.constants.values;
+    if (values.empty()) { return; }
+    fprintf(out, "const NativeConstant constants%zu[] = {\n", index);
+    for (Value value : values) {
+        if (IS_NUMBER(value)) {
+            fprintf(out, "    {NativeConstant::NUMBER, 0x%016llx, nullptr, 0},\n", static_cast<unsigned long long>(std::bit_cast<uint64_t>(AS_NUMBER(value))));
+        } else if (IS_STRING(value)) {
+            fprintf(out, "    {NativeConstant::STRING, 0, ");
+            emitString(AS_STRING(value)->getChars(), AS_STRING(value)->getLength());
+            fprintf(out, ", %d},\n", AS_STRING(value)->getLength());
+        } else {
+            fprintf(out, "    {NativeConstant::%s, 0, nullptr, 0},\n", IS_NIL(value) ? "NIL" : AS_BOOL(value) ? "TRUE" : "FALSE");
+        }
+    }
+    fprintf(out, "};\n\n");
+}
+
+void Transpiler::translate(OpCode op, uint32_t operand, unsigned line)
+{
+    int top = depth;
+    switch (op) {
+    case OP_ADD:
+        fprintf(out, "    if (IS_NUMBER(stack[%d]) && IS_NUMBER(stack[%d])) {\n", top - 2, top - 1);
+        fprintf(out, "        stack[%d] = NUMBER_VAL(AS_NUMBER(stack[%d]) + AS_NUMBER(stack[%d]));\n", top - 2, top - 2, top - 1);
+        fprintf(out, "    } else if (!runtime.add(stack + %d, %u)) {\n        return false;\n    }\n", top, line);
+        --depth;
+        break;
+    case OP_CONSTANT:
+    case OP_CONSTANT_LONG:
+        fprintf(out, "    stack[%d] = ", top);
+        emitConstant(operand);
+        fprintf(out, ";\n");
+        ++depth;
+        break;
+    case OP_DEFINE_GLOBAL:
+    case OP_DEFINE_GLOBAL_LONG:
+        fprintf(out, "    globals[%u] = stack[%d];\n", operand, top - 1);
+        --depth;
+        break;
+    case OP_DIVIDE:
+        binary("NUMBER_VAL", "/", false, line);
+        break;
+    case OP_EQUAL:
+    case OP_NOT_EQUAL:
+        fprintf(out, "    stack[%d] = BOOL_VAL(%sruntime.equal(stack + %d));\n", top - 2, op == OP_NOT_EQUAL ? "!" : "", top);
+        --depth;
+        break;
+    case OP_FALSE:
+        fprintf(out, "    stack[%d] = BOOL_VAL(false);\n", top);
+        ++depth;
+        break;
+    case OP_GET_GLOBAL:
+    case OP_GET_GLOBAL_LONG:
+        fprintf(out, "    stack[%d] = globals[%u];\n", top, operand);
+        fprintf(out, "    if (IS_UNDEFINED(stack[%d])) { return runtime.undefinedVariable(%u, %u); }\n", top, operand, line);
+        ++depth;
+        break;
+    case OP_GREATER:
+        binary("BOOL_VAL", ">", false, line);
+        break;
+    case OP_GREATER_EQUAL:
+        // !(a < b), as the interpreter computes it
+        binary("BOOL_VAL", "<", true, line);
+        break;
+    case OP_IMPORT:
+    case OP_IMPORT_LONG:
+        fprintf(out, "    if (!runtime.import(%u, stack + %d)) { return false; }\n", operand, top);
+        break;
+    case OP_LESS:
+        binary("BOOL_VAL", "<", false, line);
+        break;
+    case OP_LESS_EQUAL:
+        binary("BOOL_VAL", ">", true, line);
+        break;
+    case OP_MULTIPLY:
+        binary("NUMBER_VAL", "*", false, line);
+        break;
+    case OP_NEGATE:
+        fprintf(out, "    if (!IS_NUMBER(stack[%d])) { return runtime.error(%u, \"Operand must be a number.\"); }\n", top - 1, line);
+        fprintf(out, "    stack[%d] = NUMBER_VAL(-AS_NUMBER(stack[%d]));\n", top - 1, top - 1);
+        break;
+    case OP_NIL:
+        fprintf(out, "    stack[%d] = NIL_VAL;\n", top);
+        ++depth;
+        break;
+    case OP_NOT:
+        fprintf(out, "    stack[%d] = BOOL_VAL(isFalsey(stack[%d]));\n", top - 1, top - 1);
+        break;
+    case OP_POP:
+        --depth;
+        break;
+    case OP_PRINT:
+        fprintf(out, "    runtime.print(stack + %d);\n", top);
+        --depth;
+        break;
+    case OP_RETURN:
+        fprintf(out, "    return true;\n");
+        break;
+    case OP_SET_GLOBAL:
+    case OP_SET_GLOBAL_LONG:
+        fprintf(out, "    if (IS_UNDEFINED(globals[%u])) { return runtime.undefinedAssignment(%u, %u); }\n", operand, operand, line);
+        fprintf(out, "    globals[%u] = stack[%d];\n", operand, top - 1);
+        break;
+    case OP_SUBTRACT:
+        binary("NUMBER_VAL", "-", false, line);
+        break;
+    case OP_TRUE:
+        fprintf(out, "    stack[%d] = BOOL_VAL(true);\n", top);
+        ++depth;
+        break;
+    default:
+        // superinstructions are translated part by part, and register instructions never occur in stack code
+        break;
+    }
+}
+
+void Transpiler::binary(const char *valueType, const char *op, bool negated, unsigned line)
+{
+    int a = depth - 2;
+    int b = depth - 1;
+    fprintf(out, "    if (!IS_NUMBER(stack[%d]) || !IS_NUMBER(stack[%d])) { return runtime.error(%u, \"Operands must be numbers.\"); }\n", a, b, line);
+    fprintf(out, "    stack[%d] = %s(%sAS_NUMBER(stack[%d]) %s AS_NUMBER(stack[%d])%s);\n", a, valueType, negated ? "!(" : "", a, op, b, negated ? ")" : "");
+    --depth;
+}
+
+// numbers as exact hexadecimal literals, or by their bits if they have none
+void Transpiler::emitConstant(uint32_t index)
+{
+    Value value = code->constants.values[index];
+    if (IS_NUMBER(value)) {
+        double number = AS_NUMBER(value);
+        if (std::isfinite(number)) {
+            fprintf(out, "NUMBER_VAL(%a)", number);
+        } else {
+            fprintf(out, "NUMBER_VAL(std::bit_cast<double>(UINT64_C(0x%016llx)))", static_cast<unsigned long long>(std::bit_cast<uint64_t>(number)));
+        }
+    } else if (IS_OBJ(value)) {
+        fprintf(out, "constants[%u]", index);
+    } else {
+        fprintf(out, "%s", IS_NIL(value) ? "NIL_VAL" : AS_BOOL(value) ? "BOOL_VAL(true)" : "BOOL_VAL(false)");
+    }
+}
+
+// escaped with three digit octal escapes, which a following digit cannot extend
+void Transpiler::emitString(const char *chars, int length)
+{
+    fputc('"', out);
+    for (int i = 0; i != length; ++i) {
+        unsigned char c = static_cast<unsigned char>(chars[i]);
+        if (c == '"' || c == '\\') {
+            fprintf(out, "\\%c", c);
+        } else if (c < 0x20 || c >= 0x7F || c == '?') {
+            fprintf(out, "\\%03o", c);
+        } else {
+            fputc(c, out);
+        }
+    }
+    fputc('"', out);
+}
@@ -0,0 +1,54 @@
+#ifndef CXXLOX_TRANSPILER_H
+#define CXXLOX_TRANSPILER_H
+
+#include <cstdio>
+
+#include "chunk.h"
+
+class VM;
+
+// Translates a compiled script, and every module it imports, into a C++ translation unit for --emit-cpp. Built against
+// the runtime (`make native SCRIPT=path`), the unit is a program that runs the script on NativeRuntime (see native.h)
+// with no bytecode left to dispatch.
+//
+// The code is straight-line, so the depth of the stack before each instruction is known here, and each instruction
+// becomes a few statements on fixed slots of the VM's stack:
+//
+//     // line 3
+//     stack[0] = globals[1];
+//     if (IS_UNDEFINED(stack[0])) { return runtime.undefinedVariable(1, 3); }
+//     stack[1] = NUMBER_VAL(0x1p+1);
+//
+// Number constants are written into the code, so the host compiler can fold them. Arithmetic and comparisons on
+// numbers, the globals, nil, true, false and ! are inline; strings, printing, imports and runtime errors go through
+// NativeRuntime, which reports the errors with the messages and lines of the interpreter.
+//
+// A chunk is split into functions of a few hundred instructions each, cut where the stack is empty, so that the host
+// compiler never has to optimize one function the size of the script.
+class Transpiler
+{
+public:
+    // chunk was compiled by vm, whose modules are the ones it imports
+    Transpiler(const VM &vm, const Chunk &chunk) : vm(vm), chunk(chunk) {}
+
+    void emit(FILE *out);
+
+private:
+    static constexpr size_t PART_INSTRUCTIONS = 256;
+
+    const VM &vm;
+    const Chunk &chunk;
+    FILE *out = nullptr;
+    const Chunk *code = nullptr;  // being translated
+    int depth = 0;  // of the stack before the instruction being translated
+
+    void emitChunk(size_t index, const Chunk &code);
+    void emitConstants(size_t index, const Chunk &code);
+    void translate(OpCode op, uint32_t operand, unsigned line);
+    // a op b for the two numbers on top of the stack, as valueType, or as its negation if negated
+    void binary(const char *valueType, const char *op, bool negated, unsigned line);
+    // the value of constant index of the chunk being translated
+    void emitConstant(uint32_t index);
+    void emitString(const char *chars, int length);
+};
+#endif
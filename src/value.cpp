@@ -7,14 +7,31 @@
 void printObject(Value value)
 {
     switch (OBJ_TYPE(value)) {
+    case OBJ_ROPE:
+        printf("%s", AS_ROPE(value)->flatten()->getChars());
+        break;
     case OBJ_STRING:
         printf("%s", AS_CSTRING(value));
         break;
     }
 }
 
+// a rope's identity is not its content, so it is compared through the interned string it flattens to
+static Value flattenRope(Value value) { return IS_ROPE(value) ? OBJ_VAL(AS_ROPE(value)->flatten()) : value; }
+
 void printValue(Value value)
 {
+#ifdef NAN_BOXING
+    if (IS_BOOL(value)) {
+        printf(AS_BOOL(value) ? "true" : "false");
+    } else if (IS_NIL(value)) {
+        printf("nil");
+    } else if (IS_NUMBER(value)) {
+        printf("%g", AS_NUMBER(value));
+    } else if (IS_OBJ(value)) {
+        printObject(value);
+    }
+#else
     switch (value.type) {
     case VAL_BOOL:
         printf(AS_BOOL(value) ? "true" : "false");
@@ -28,11 +45,21 @@ void printValue(Value value)
     case VAL_OBJ:
         printObject(value);
         break;
+    case VAL_UNDEFINED:
+        break;
     }
+#endif
 }
 
 bool valuesEqual(Value a, Value b)
 {
+    a = flattenRope(a);
+    b = flattenRope(b);
+#ifdef NAN_BOXING
+    // NaN != NaN still has to hold, so numbers are compared as doubles rather than as bit patterns
+    if (IS_NUMBER(a) && IS_NUMBER(b)) { return AS_NUMBER(a) == AS_NUMBER(b); }
+    return a == b;
+#else
     if (a.type != b.type) { return false; }
     switch (a.type) {
     case VAL_BOOL:
@@ -46,4 +73,5 @@ bool valuesEqual(Value a, Value b)
     default:
         return false;
     }
+#endif
 }
@@ -1,6 +1,7 @@
 #ifndef CXXLOX_VALUE_H
 #define CXXLOX_VALUE_H
 
+#include <bit>
 #include <vector>
 
 #include "common.h"
@@ -8,12 +9,51 @@
 class Obj;
 class ObjString;
 
+#ifdef NAN_BOXING
+
+// A quiet NaN with the sign bit set tags an Obj pointer, the low bits of a plain quiet NaN tag the singletons,
+// and every other bit pattern is a double.
+#define SIGN_BIT ((uint64_t) 0x8000000000000000)
+#define QNAN ((uint64_t) 0x7ffc000000000000)
+
+#define TAG_NIL 1    // 01.
+#define TAG_FALSE 2  // 10.
+#define TAG_TRUE 3   // 11.
+#define TAG_UNDEFINED 4  // 100.
+
+using Value = uint64_t;
+
+#define IS_BOOL(value) (((value) | 1) == TRUE_VAL)
+#define IS_NIL(value) ((value) == NIL_VAL)
+#define IS_NUMBER(value) (((value) &QNAN) != QNAN)
+#define IS_OBJ(value) (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+#define IS_UNDEFINED(value) ((value) == UNDEFINED_VAL)
+
+#define AS_BOOL(value) ((value) == TRUE_VAL)
+#define AS_NUMBER(value) valueToNum(value)
+#define AS_OBJ(value) ((Obj *) (uintptr_t) ((value) & ~(SIGN_BIT | QNAN)))
+
+#define BOOL_VAL(b) ((b) ? TRUE_VAL : FALSE_VAL)
+#define FALSE_VAL ((Value) (uint64_t) (QNAN | TAG_FALSE))
+#define TRUE_VAL ((Value) (uint64_t) (QNAN | TAG_TRUE))
+#define NIL_VAL ((Value) (uint64_t) (QNAN | TAG_NIL))
+#define UNDEFINED_VAL ((Value) (uint64_t) (QNAN | TAG_UNDEFINED))
+#define NUMBER_VAL(num) numToValue(num)
+#define OBJ_VAL(obj) (Value)(SIGN_BIT | QNAN | (uint64_t) (uintptr_t) (obj))
+
+static inline double valueToNum(Value value) { return std::bit_cast<double>(value); }
+
+static inline Value numToValue(double num) { return std::bit_cast<Value>(num); }
+
+#else
+
 enum ValueType
 {
     VAL_BOOL,
     VAL_NIL,
     VAL_NUMBER,
-    VAL_OBJ
+    VAL_OBJ,
+    VAL_UNDEFINED,
 };
 
 struct Value
@@ -30,6 +70,7 @@ struct Value
 #define IS_NIL(value) ((value).type == VAL_NIL)
 #define IS_NUMBER(value) ((value).type == VAL_NUMBER)
 #define IS_OBJ(value) ((value).type == VAL_OBJ)
+#define IS_UNDEFINED(value) ((value).type == VAL_UNDEFINED)
 
 #define AS_BOOL(value) ((value).as.boolean)
 #define AS_NUMBER(value) ((value).as.number)
@@ -39,11 +80,21 @@ struct Value
 #define NIL_VAL ((Value){VAL_NIL, {.number = 0}})
 #define NUMBER_VAL(value) ((Value){VAL_NUMBER, {.number = value}})
 #define OBJ_VAL(object) ((Value){VAL_OBJ, {.obj = (Obj *) object}})
+#define UNDEFINED_VAL ((Value){VAL_UNDEFINED, {.number = 0}})
+
+#endif
 
 class ValueArray
 {
+    friend class BytecodeCache;
     friend class Chunk;
     friend class Disassembler;
+    friend class JitCompiler;
+    friend class ModuleLoader;
+    friend class NativeRuntime;
+    friend class Optimizer;
+    friend class RegisterCompiler;
+    friend class Transpiler;
     friend class VM;
     friend bool valuesEqual(Value a, Value b);
 
@@ -57,4 +108,6 @@ private:
 
 bool valuesEqual(Value a, Value b);
 
+static inline bool isFalsey(Value value) { return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value)); }
+
 #endif
@@ -1,156 +1,560 @@
+#include <algorithm>
 #include <cstdarg>
 #include <cstdio>
+#include <filesystem>
 
 #include "chunk.h"
 #include "compiler.h"
 #include "debug.h"
+#include "jit.h"
+#include "module.h"
 #include "object.h"
+#include "register.h"
 #include "value.h"
 #include "vm.h"
 
-static inline bool isFalsey(Value value) { return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value)); }
+VM::VM() = default;
+
+VM::VM(const InterpretOptions &options) : options(options) {}
+
+// the loader's workers are stopped before the heap goes away
+VM::~VM() = default;
 
 InterpretResult VM::interpret(const std::string &source)
 {
     Chunk chunk;
-    Compiler compiler;
-    if (!compiler.compile(source, chunk)) { return INTERPRET_COMPILE_ERROR; }
+    if (!compile(source, chunk)) { return INTERPRET_COMPILE_ERROR; }
+    return execute(chunk);
+}
+
+// every global's name is interned, so a name that is not can not be one, and looking it up allocates nothing
+bool VM::getGlobal(std::string_view name, Value *value)
+{
+    int length = static_cast<int>(name.size());
+    ObjString *key = strings.findString(name.data(), length, hashString(name.data(), length));
+    Value slot;
+    if (key == nullptr || !globals.slots.get(key, &slot)) { return false; }
+    Value &global = globals.slotValues[static_cast<size_t>(AS_NUMBER(slot))];
+    if (IS_UNDEFINED(global)) { return false; }
+    if (IS_ROPE(global)) { global = OBJ_VAL(AS_ROPE(global)->flatten()); }
+    *value = global;
+    return true;
+}
+
+void VM::setGlobal(std::string_view name, Value value)
+{
+    // interning the name may collect garbage, which must not take the value with it
+    push(value);
+    int slot = globals.slot(AS_STRING(makeString(name)));
+    globals.slotValues[slot] = pop();
+}
+
+bool VM::compile(std::string_view source, Chunk &chunk, std::string_view path)
+{
+    if (moduleLoader == nullptr) { moduleLoader = std::make_unique<ModuleLoader>(); }
+    ChunkScope scope(*this, &chunk);
+    Compiler compiler(*this, options, *moduleLoader, std::filesystem::path(path).parent_path().string());
+    bool compiled = compiler.compile(source, chunk);
+    // the modules it imports were compiled by the workers meanwhile; they are linked even if the script has errors, so
+    // that theirs are reported too
+    bool linked = moduleLoader->link(*this);
+    return compiled && linked;
+}
 
-    this->chunk = &chunk;
-    ip = chunk.code.cbegin();
+InterpretResult VM::execute(Chunk &chunk)
+{
+    if (options.profileOpcodes) { return runChunk<Profiled>(chunk, ""); }
+    return options.traceExecution ? runChunk<Traced>(chunk, "") : runChunk<Untraced>(chunk, "");
+}
+
+template <typename Policy>
+InterpretResult VM::runModule(uint32_t index)
+{
+    Module &module = modules[index];
+    // marked before it runs, so that modules importing each other do not import each other forever
+    if (module.imported) { return INTERPRET_OK; }
+    module.imported = true;
+
+    const uint8_t *importIp = ip;
+    const Module *importer = runningModule;
+    runningModule = &module;
+    InterpretResult result = runChunk<Policy>(module.chunk, module.path);
+    runningModule = importer;
+    ip = importIp;
+    return result;
+}
+
+// The register code is translated each time a chunk is run rather than when it is compiled, so that chunks loaded from
+// the cache and linked modules run as register code too; the translation is a single pass over the code. Code that
+// needs more registers than are left on the stack runs as it is.
+template <typename Policy>
+InterpretResult VM::runChunk(Chunk &chunk, std::string_view name)
+{
+    ChunkScope scope(*this, &chunk);
+    // the machine code has no hooks for tracing or profiling
+    if constexpr (!Policy::trace && !Policy::profile) {
+        JitCode machineCode;
+        if (options.jit && JitCompiler(chunk, globals.values()).compile(machineCode)) {
+            Value *top = machineCode.run(*this, stackTop);
+            if (top == nullptr) { return INTERPRET_RUNTIME_ERROR; }
+            stackTop = top;
+            return INTERPRET_OK;
+        }
+    }
+    Chunk registerCode;
+    RegisterCompiler compiler(chunk, registerCode, static_cast<int>(stack + STACK_MAX - stackTop));
+    if (!options.registerMachine || !compiler.compile()) {
+        ip = chunk.code.data();
+        if constexpr (Policy::profile) { profiler.beginChunk(chunk, name); }
+        InterpretResult result = run<Policy>(chunk);
+        if constexpr (Policy::profile) { profiler.endChunk(); }
+        return result;
+    }
 
-    InterpretResult result = run();
+    if (options.printCode) { disassembleChunk(registerCode, (std::string(name.empty() ? "code" : name) + " registers").c_str(), globals); }
+    ChunkScope registerScope(*this, &registerCode);
+    // the registers are roots while the code runs; they start out nil rather than as whatever the stack held
+    Value *registers = stackTop;
+    std::fill(registers, registers + compiler.getRegisterCount(), NIL_VAL);
+    stackTop = registers + compiler.getRegisterCount();
+    ip = registerCode.code.data();
+    if constexpr (Policy::profile) { profiler.beginChunk(registerCode, name); }
+    InterpretResult result = runRegisters<Policy>(registers);
+    if constexpr (Policy::profile) { profiler.endChunk(); }
+    if (result == INTERPRET_OK) { stackTop = registers; }
     return result;
 }
 
-InterpretResult VM::run()
+template <typename Policy>
+InterpretResult VM::run(Chunk &chunk)
 {
+    // ip and stackTop are cached in locals so they can stay in registers for the whole loop; the members are only
+    // brought up to date before leaving the loop or calling something that reads them
+    const uint8_t *ip = this->ip;
+    Value *stackTop = this->stackTop;
+    // no slots are added while the chunk runs, so the array cannot move under us
+    Value *globalValues = globals.values();
+
 #define READ_BYTE() (*ip++)
-#define READ_CONSTANT() (chunk->constants.values[READ_BYTE()])
-#define READ_STRING() AS_STRING(READ_CONSTANT())
+#define READ_LONG() (ip += 3, static_cast<uint32_t>(ip[-3] | ip[-2] << 8 | ip[-1] << 16))
+#define READ_CONSTANT() (chunk.constants.values[READ_BYTE()])
+#define READ_CONSTANT_LONG() (chunk.constants.values[READ_LONG()])
+#define PUSH(value) (*stackTop++ = (value))
+#define POP() (*--stackTop)
+#define PEEK(distance) (stackTop[-1 - (distance)])
+#define STORE_FRAME() (this->ip = ip, this->stackTop = stackTop)
+#define LOAD_FRAME() (ip = this->ip, stackTop = this->stackTop)
+#define RUNTIME_ERROR(...)              \
+    do {                                \
+        STORE_FRAME();                  \
+        runtimeError(__VA_ARGS__);      \
+        return INTERPRET_RUNTIME_ERROR; \
+    } while (false)
+// a op b for the two numbers on top of the stack, as a value of valueType
+#define NUMBER_OP(valueType, op)     \
+    do {                             \
+        double b = AS_NUMBER(POP()); \
+        double a = AS_NUMBER(POP()); \
+        PUSH(valueType(a op b));     \
+    } while (false)
 #define BINARY_OP(valueType, op)                          \
     do {                                                  \
-        if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
-            runtimeError("Operands must be numbers.");    \
-            return INTERPRET_RUNTIME_ERROR;               \
+        if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) { \
+            RUNTIME_ERROR("Operands must be numbers.");   \
         }                                                 \
-        double b = AS_NUMBER(pop());                      \
-        double a = AS_NUMBER(pop());                      \
-        push(valueType(a op b));                          \
+        NUMBER_OP(valueType, op);                         \
+    } while (false)
+// comparing a rope flattens it, which allocates, so the operands stay on the stack until the result is known
+#define EQUAL_VALUES(valueType)                         \
+    do {                                                \
+        STORE_FRAME();                                  \
+        bool equal = valuesEqual(PEEK(1), PEEK(0));     \
+        stackTop -= 2;                                  \
+        PUSH(valueType(equal));                         \
     } while (false)
+// rewrites the instruction executing, which has no operands, to another form of it for its next execution
+#define QUICKEN(op) chunk.quicken(ip - 1 - chunk.code.data(), op)
 
-    for (;;) {
-#ifdef DEBUG_TRACE_EXECUTION
-        printf("          ");
-        for (const Value *slot = stack; slot != stackTop; slot++) {
-            printf("[ ");
-            printValue(*slot);
-            printf(" ]");
-        }
-        printf("\n");
-        disassembleInstruction(*chunk, ip - chunk->code.cbegin());
+// the bodies of the instructions superinstructions are made of, so that a superinstruction is just its parts in a row
+#define ADD_VALUES()                                                      \
+    do {                                                                  \
+        if (IS_ANY_STRING(PEEK(0)) && IS_ANY_STRING(PEEK(1))) {           \
+            STORE_FRAME();                                                \
+            concatenate();                                                \
+            LOAD_FRAME();                                                 \
+        } else if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1))) {            \
+            NUMBER_OP(NUMBER_VAL, +);                                     \
+        } else {                                                          \
+            RUNTIME_ERROR("Operand must be two numbers or two strings."); \
+        }                                                                 \
+    } while (false)
+#define GET_GLOBAL(slot)                                                                                       \
+    do {                                                                                                       \
+        Value value = globalValues[slot];                                                                      \
+        if (IS_UNDEFINED(value)) { RUNTIME_ERROR("Undefined variable '%s'.", globals.name(slot)->getChars()); } \
+        PUSH(value);                                                                                           \
+    } while (false)
+#define SET_GLOBAL(slot)                                                                                                   \
+    do {                                                                                                                   \
+        if (IS_UNDEFINED(globalValues[slot])) { RUNTIME_ERROR("Undefined varible: '%s'", globals.name(slot)->getChars()); } \
+        globalValues[slot] = PEEK(0);                                                                                      \
+    } while (false)
+#define NEGATED_BOOL_VAL(b) BOOL_VAL(!(b))
+// the module runs in a loop of its own and leaves the stack as it found it; an error in it has already been reported
+#define IMPORT(module)                                      \
+    do {                                                    \
+        STORE_FRAME();                                      \
+        InterpretResult result = runModule<Policy>(module); \
+        if (result != INTERPRET_OK) { return result; }      \
+        LOAD_FRAME();                                       \
+    } while (false)
+
+#define TRACE_INSTRUCTION()                                              \
+    do {                                                                 \
+        if constexpr (Policy::trace) {                                   \
+            STORE_FRAME();                                               \
+            traceInstruction(ip, stackTop);                              \
+        }                                                                \
+        if constexpr (Policy::profile) {                                 \
+            profiler.record(ip - chunk.code.data());                     \
+        }                                                                \
+    } while (false)
+
+#ifdef COMPUTED_GOTO
+    // every handler jumps straight to the next one, so each opcode gets its own indirect branch to predict;
+    // the switch below is only entered once, for the first instruction
+    static void *dispatchTable[] = {
+        [OP_ADD] = &&LABEL_OP_ADD,
+        [OP_CONSTANT] = &&LABEL_OP_CONSTANT,
+        [OP_CONSTANT_LONG] = &&LABEL_OP_CONSTANT_LONG,
+        [OP_DEFINE_GLOBAL] = &&LABEL_OP_DEFINE_GLOBAL,
+        [OP_DEFINE_GLOBAL_LONG] = &&LABEL_OP_DEFINE_GLOBAL_LONG,
+        [OP_DIVIDE] = &&LABEL_OP_DIVIDE,
+        [OP_EQUAL] = &&LABEL_OP_EQUAL,
+        [OP_FALSE] = &&LABEL_OP_FALSE,
+        [OP_GET_GLOBAL] = &&LABEL_OP_GET_GLOBAL,
+        [OP_GET_GLOBAL_LONG] = &&LABEL_OP_GET_GLOBAL_LONG,
+        [OP_GREATER] = &&LABEL_OP_GREATER,
+        [OP_GREATER_EQUAL] = &&LABEL_OP_GREATER_EQUAL,
+        [OP_IMPORT] = &&LABEL_OP_IMPORT,
+        [OP_IMPORT_LONG] = &&LABEL_OP_IMPORT_LONG,
+        [OP_LESS] = &&LABEL_OP_LESS,
+        [OP_LESS_EQUAL] = &&LABEL_OP_LESS_EQUAL,
+        [OP_MULTIPLY] = &&LABEL_OP_MULTIPLY,
+        [OP_NIL] = &&LABEL_OP_NIL,
+        [OP_NOT] = &&LABEL_OP_NOT,
+        [OP_NOT_EQUAL] = &&LABEL_OP_NOT_EQUAL,
+        [OP_NEGATE] = &&LABEL_OP_NEGATE,
+        [OP_POP] = &&LABEL_OP_POP,
+        [OP_PRINT] = &&LABEL_OP_PRINT,
+        [OP_RETURN] = &&LABEL_OP_RETURN,
+        [OP_SET_GLOBAL] = &&LABEL_OP_SET_GLOBAL,
+        [OP_SET_GLOBAL_LONG] = &&LABEL_OP_SET_GLOBAL_LONG,
+        [OP_SUBTRACT] = &&LABEL_OP_SUBTRACT,
+        [OP_TRUE] = &&LABEL_OP_TRUE,
+        [OP_GET_GLOBAL_ADD_SET_GLOBAL] = &&LABEL_OP_GET_GLOBAL_ADD_SET_GLOBAL,
+        [OP_GET_GLOBAL_CONSTANT_ADD] = &&LABEL_OP_GET_GLOBAL_CONSTANT_ADD,
+        [OP_GET_GLOBAL_CONSTANT_DIVIDE] = &&LABEL_OP_GET_GLOBAL_CONSTANT_DIVIDE,
+        [OP_GET_GLOBAL_GET_GLOBAL] = &&LABEL_OP_GET_GLOBAL_GET_GLOBAL,
+        [OP_GET_GLOBAL_MULTIPLY_ADD] = &&LABEL_OP_GET_GLOBAL_MULTIPLY_ADD,
+        [OP_SET_GLOBAL_POP] = &&LABEL_OP_SET_GLOBAL_POP,
+        [OP_ADD_NUM] = &&LABEL_OP_ADD_NUM,
+        [OP_ADD_STR] = &&LABEL_OP_ADD_STR,
+        [OP_EQUAL_NUM] = &&LABEL_OP_EQUAL_NUM,
+        [OP_NOT_EQUAL_NUM] = &&LABEL_OP_NOT_EQUAL_NUM,
+        [OP_ADD_GENERIC] = &&LABEL_OP_ADD_GENERIC,
+        [OP_EQUAL_GENERIC] = &&LABEL_OP_EQUAL_GENERIC,
+        [OP_NOT_EQUAL_GENERIC] = &&LABEL_OP_NOT_EQUAL_GENERIC,
+    };
+#define CASE(opcode) \
+    case opcode:     \
+        LABEL_##opcode:
+#define DISPATCH()                        \
+    do {                                  \
+        TRACE_INSTRUCTION();              \
+        goto *dispatchTable[READ_BYTE()]; \
+    } while (false)
+#else
+#define CASE(opcode) case opcode:
+#define DISPATCH() continue
 #endif
-        uint8_t instruction;
-        switch (instruction = READ_BYTE()) {
-        case OP_ADD: {
-            if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
-                concatenate();
-            } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
-                double b = AS_NUMBER(pop());
-                double a = AS_NUMBER(pop());
-                push(NUMBER_VAL(a + b));
-            } else {
-                runtimeError("Operand must be two numbers or two strings.");
-                return INTERPRET_RUNTIME_ERROR;
+
+    for (;;) {
+        TRACE_INSTRUCTION();
+        switch (READ_BYTE()) {
+        CASE(OP_ADD) {
+            // quickened for the operands it sees first; operands that add up to nothing are reported below instead
+            if (options.quicken) {
+                if (IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1))) {
+                    QUICKEN(OP_ADD_NUM);
+                } else if (IS_ANY_STRING(PEEK(0)) && IS_ANY_STRING(PEEK(1))) {
+                    QUICKEN(OP_ADD_STR);
+                }
             }
-            break;
+            ADD_VALUES();
+            DISPATCH();
         }
-        case OP_CONSTANT: {
+        CASE(OP_CONSTANT) {
             Value constant = READ_CONSTANT();
-            push(constant);
-            break;
+            PUSH(constant);
+            DISPATCH();
+        }
+        CASE(OP_CONSTANT_LONG) {
+            Value constant = READ_CONSTANT_LONG();
+            PUSH(constant);
+            DISPATCH();
         }
-        case OP_DEFINE_GLOBAL: {
-            ObjString *name = READ_STRING();
-            globals.set(name, peek(0));
-            pop();
-            break;
+        CASE(OP_DEFINE_GLOBAL) {
+            globalValues[READ_BYTE()] = POP();
+            DISPATCH();
         }
-        case OP_DIVIDE:
+        CASE(OP_DEFINE_GLOBAL_LONG) {
+            globalValues[READ_LONG()] = POP();
+            DISPATCH();
+        }
+        CASE(OP_DIVIDE) {
             BINARY_OP(NUMBER_VAL, /);
-            break;
-        case OP_EQUAL: {
-            Value b = pop();
-            Value a = pop();
-            push(BOOL_VAL(valuesEqual(a, b)));
-            break;
-        }
-        case OP_GET_GLOBAL: {
-            ObjString *name = READ_STRING();
-            Value value;
-            if (!globals.get(name, &value)) {
-                runtimeError("Undefined variable '%s'.", name->getChars());
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            push(value);
-            break;
+            DISPATCH();
+        }
+        CASE(OP_EQUAL) {
+            if (options.quicken && IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1))) { QUICKEN(OP_EQUAL_NUM); }
+            EQUAL_VALUES(BOOL_VAL);
+            DISPATCH();
+        }
+        CASE(OP_GET_GLOBAL) {
+            uint8_t slot = READ_BYTE();
+            GET_GLOBAL(slot);
+            DISPATCH();
+        }
+        CASE(OP_GET_GLOBAL_LONG) {
+            uint32_t slot = READ_LONG();
+            GET_GLOBAL(slot);
+            DISPATCH();
         }
-        case OP_GREATER:
+        CASE(OP_GREATER) {
             BINARY_OP(BOOL_VAL, >);
-            break;
-        case OP_FALSE:
-            push(BOOL_VAL(false));
-            break;
-        case OP_LESS:
+            DISPATCH();
+        }
+        CASE(OP_GREATER_EQUAL) {
+            // !(a < b) rather than a >= b, to give the same answer for NaN as the OP_LESS, OP_NOT pair it replaces
+            BINARY_OP(NEGATED_BOOL_VAL, <);
+            DISPATCH();
+        }
+        CASE(OP_FALSE) {
+            PUSH(BOOL_VAL(false));
+            DISPATCH();
+        }
+        CASE(OP_IMPORT) {
+            uint8_t module = READ_BYTE();
+            IMPORT(module);
+            DISPATCH();
+        }
+        CASE(OP_IMPORT_LONG) {
+            uint32_t module = READ_LONG();
+            IMPORT(module);
+            DISPATCH();
+        }
+        CASE(OP_LESS) {
             BINARY_OP(BOOL_VAL, <);
-            break;
-        case OP_MULTIPLY:
+            DISPATCH();
+        }
+        CASE(OP_LESS_EQUAL) {
+            BINARY_OP(NEGATED_BOOL_VAL, >);
+            DISPATCH();
+        }
+        CASE(OP_MULTIPLY) {
             BINARY_OP(NUMBER_VAL, *);
-            break;
-        case OP_NEGATE:
-            if (!IS_NUMBER(peek(0))) {
-                runtimeError("Operand must be a number.");
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            push(NUMBER_VAL(-AS_NUMBER(pop())));
-            break;
-        case OP_NIL:
-            push(NIL_VAL);
-            break;
-        case OP_NOT:
-            push(BOOL_VAL(isFalsey(pop())));
-            break;
-        case OP_PRINT: {
-            printValue(pop());
+            DISPATCH();
+        }
+        CASE(OP_NEGATE) {
+            if (!IS_NUMBER(PEEK(0))) { RUNTIME_ERROR("Operand must be a number."); }
+            PEEK(0) = NUMBER_VAL(-AS_NUMBER(PEEK(0)));
+            DISPATCH();
+        }
+        CASE(OP_NIL) {
+            PUSH(NIL_VAL);
+            DISPATCH();
+        }
+        CASE(OP_NOT) {
+            PEEK(0) = BOOL_VAL(isFalsey(PEEK(0)));
+            DISPATCH();
+        }
+        CASE(OP_NOT_EQUAL) {
+            if (options.quicken && IS_NUMBER(PEEK(0)) && IS_NUMBER(PEEK(1))) { QUICKEN(OP_NOT_EQUAL_NUM); }
+            EQUAL_VALUES(NEGATED_BOOL_VAL);
+            DISPATCH();
+        }
+        CASE(OP_PRINT) {
+            STORE_FRAME();
+            printValue(PEEK(0));
             printf("\n");
-            break;
+            --stackTop;
+            DISPATCH();
+        }
+        CASE(OP_POP) {
+            --stackTop;
+            DISPATCH();
         }
-        case OP_POP:
-            pop();
-            break;
-        case OP_RETURN: {
+        CASE(OP_RETURN) {
+            STORE_FRAME();
             return INTERPRET_OK;
-        case OP_SET_GLOBAL: {
-            ObjString *name = READ_STRING();
-            if (globals.set(name, peek(0))) {
-                globals.delete_(name);
-                runtimeError("Undefined varible: '%s'", name->getChars());
-                return INTERPRET_RUNTIME_ERROR;
-            }
-            break;
         }
-        case OP_SUBTRACT:
+        CASE(OP_SET_GLOBAL) {
+            uint8_t slot = READ_BYTE();
+            SET_GLOBAL(slot);
+            DISPATCH();
+        }
+        CASE(OP_SET_GLOBAL_LONG) {
+            uint32_t slot = READ_LONG();
+            SET_GLOBAL(slot);
+            DISPATCH();
+        }
+        CASE(OP_SUBTRACT) {
             BINARY_OP(NUMBER_VAL, -);
-            break;
-        case OP_TRUE:
-            push(BOOL_VAL(true));
-            break;
+            DISPATCH();
+        }
+        CASE(OP_TRUE) {
+            PUSH(BOOL_VAL(true));
+            DISPATCH();
+        }
+        CASE(OP_GET_GLOBAL_ADD_SET_GLOBAL) {
+            uint8_t slot = READ_BYTE();
+            GET_GLOBAL(slot);
+            ADD_VALUES();
+            slot = READ_BYTE();
+            SET_GLOBAL(slot);
+            DISPATCH();
+        }
+        CASE(OP_GET_GLOBAL_CONSTANT_ADD) {
+            uint8_t slot = READ_BYTE();
+            GET_GLOBAL(slot);
+            PUSH(READ_CONSTANT());
+            ADD_VALUES();
+            DISPATCH();
+        }
+        CASE(OP_GET_GLOBAL_CONSTANT_DIVIDE) {
+            uint8_t slot = READ_BYTE();
+            GET_GLOBAL(slot);
+            PUSH(READ_CONSTANT());
+            BINARY_OP(NUMBER_VAL, /);
+            DISPATCH();
+        }
+        CASE(OP_GET_GLOBAL_GET_GLOBAL) {
+            uint8_t slot = READ_BYTE();
+            GET_GLOBAL(slot);
+            slot = READ_BYTE();
+            GET_GLOBAL(slot);
+            DISPATCH();
+        }
+        CASE(OP_GET_GLOBAL_MULTIPLY_ADD) {
+            uint8_t slot = READ_BYTE();
+            GET_GLOBAL(slot);
+            BINARY_OP(NUMBER_VAL, *);
+            ADD_VALUES();
+            DISPATCH();
+        }
+        CASE(OP_SET_GLOBAL_POP) {
+            uint8_t slot = READ_BYTE();
+            SET_GLOBAL(slot);
+            --stackTop;
+            DISPATCH();
+        }
+        // each checks only the types it was quickened for; when they do not match, the instruction becomes the
+        // *_GENERIC form for good, rather than quickening again for whatever it sees next
+        CASE(OP_ADD_NUM) {
+            if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) {
+                QUICKEN(OP_ADD_GENERIC);
+                ADD_VALUES();
+                DISPATCH();
+            }
+            NUMBER_OP(NUMBER_VAL, +);
+            DISPATCH();
+        }
+        CASE(OP_ADD_STR) {
+            if (!IS_ANY_STRING(PEEK(0)) || !IS_ANY_STRING(PEEK(1))) {
+                QUICKEN(OP_ADD_GENERIC);
+                ADD_VALUES();
+                DISPATCH();
+            }
+            STORE_FRAME();
+            concatenate();
+            LOAD_FRAME();
+            DISPATCH();
+        }
+        CASE(OP_EQUAL_NUM) {
+            if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) {
+                QUICKEN(OP_EQUAL_GENERIC);
+                EQUAL_VALUES(BOOL_VAL);
+                DISPATCH();
+            }
+            NUMBER_OP(BOOL_VAL, ==);
+            DISPATCH();
+        }
+        CASE(OP_NOT_EQUAL_NUM) {
+            if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) {
+                QUICKEN(OP_NOT_EQUAL_GENERIC);
+                EQUAL_VALUES(NEGATED_BOOL_VAL);
+                DISPATCH();
+            }
+            NUMBER_OP(BOOL_VAL, !=);
+            DISPATCH();
+        }
+        CASE(OP_ADD_GENERIC) {
+            ADD_VALUES();
+            DISPATCH();
+        }
+        CASE(OP_EQUAL_GENERIC) {
+            EQUAL_VALUES(BOOL_VAL);
+            DISPATCH();
+        }
+        CASE(OP_NOT_EQUAL_GENERIC) {
+            EQUAL_VALUES(NEGATED_BOOL_VAL);
+            DISPATCH();
         }
         }
     }
 #undef READ_BYTE
+#undef READ_LONG
 #undef READ_CONSTANT
-#undef READ_STRING
+#undef READ_CONSTANT_LONG
+#undef PUSH
+#undef POP
+#undef PEEK
+#undef STORE_FRAME
+#undef LOAD_FRAME
+#undef RUNTIME_ERROR
+#undef NUMBER_OP
+#undef BINARY_OP
+#undef EQUAL_VALUES
+#undef QUICKEN
+#undef ADD_VALUES
+#undef GET_GLOBAL
+#undef SET_GLOBAL
+#undef NEGATED_BOOL_VAL
+#undef IMPORT
+#undef TRACE_INSTRUCTION
+#undef CASE
+#undef DISPATCH
+}
+
+template InterpretResult VM::run<Untraced>(Chunk &chunk);
+template InterpretResult VM::run<Traced>(Chunk &chunk);
+template InterpretResult VM::run<Profiled>(Chunk &chunk);
+// the register machine imports modules through these
+template InterpretResult VM::runModule<Untraced>(uint32_t index);
+template InterpretResult VM::runModule<Traced>(uint32_t index);
+template InterpretResult VM::runModule<Profiled>(uint32_t index);
+
+void VM::traceInstruction(const uint8_t *ip, const Value *stackTop)
+{
+    printf("          ");
+    for (const Value *slot = stack; slot != stackTop; slot++) {
+        printf("[ ");
+        printValue(*slot);
+        printf(" ]");
+    }
+    printf("\n");
+    disassembleInstruction(*chunk, ip - chunk->code.data(), globals);
 }
 
 void VM::runtimeError(const char *format, ...)
@@ -161,27 +565,18 @@ void VM::runtimeError(const char *format, ...)
     va_end(args);
     fputs("\n", stderr);
 
-    size_t instruction = ip - chunk->code.cbegin() - 1;
-    int line = chunk->lines[instruction];
-    fprintf(stderr, "[line %d] in script\n", line);
+    size_t instruction = ip - chunk->code.data() - 1;
+    unsigned line = chunk->getLine(instruction);
+    fprintf(stderr, "[line %u] in %s\n", line, runningModule != nullptr ? runningModule->path.c_str() : "script");
 
     resetStack();
 }
 
 void VM::concatenate()
 {
-    ObjString *b = AS_STRING(pop());
-    ObjString *a = AS_STRING(pop());
-    ObjString *result = a->concatenate(*b);
+    // the operands stay on the stack while the result is allocated, so a collection cannot free them
+    Obj *result = concatenateStrings(*this, AS_OBJ(peek(1)), AS_OBJ(peek(0)));
+    pop();
+    pop();
     push(OBJ_VAL(result));
 }
-
-void VM::freeObjects()
-{
-    Obj *object = objects;
-    while (object != NULL) {
-        Obj *next = object->getNext();
-        delete object;
-        object = next;
-    }
-}
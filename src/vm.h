@@ -1,16 +1,65 @@
 #ifndef CXXLOX_VM_H
 #define CXXLOX_VM_H
 
+#include <chrono>
+#include <deque>
 #include <memory>
 #include <stack>
+#include <string>
+#include <string_view>
+#include <vector>
 
 #include "chunk.h"
 #include "memory.h"
 #include "object.h"
+#include "profiler.h"
 #include "table.h"
 
 constexpr unsigned STACK_MAX = 256;
 
+class ModuleLoader;
+class OpcodeStats;
+
+// Selected from the command line; see main.cpp
+struct InterpretOptions
+{
+    bool printCode = false;       // disassemble each chunk after compiling it
+    bool traceExecution = false;  // print the stack and the instruction before executing it
+    int optimizationLevel = 2;    // 0: run the code as compiled, 1: run the peephole optimizer, 2: also fuse superinstructions
+    OpcodeStats *opcodeStats = nullptr;  // if set, the final code of every chunk compiled is counted into it
+    bool profileOpcodes = false;         // run with the Profiled policy, which takes precedence over tracing
+    bool registerMachine = false;        // run each chunk as register code, see register.h
+    bool jit = false;                    // compile each chunk to machine code where possible, see jit.h; not with tracing or profiling
+    bool quicken = true;                 // rewrite instructions to forms specialized for the operand types they see, see Chunk::quicken()
+};
+
+// Policies VM::run() is instantiated with; instrumentation that a policy disables is not compiled into its loop at all
+struct Untraced
+{
+    static constexpr bool trace = false;
+    static constexpr bool profile = false;
+};
+
+struct Traced
+{
+    static constexpr bool trace = true;
+    static constexpr bool profile = false;
+};
+
+struct Profiled
+{
+    static constexpr bool trace = false;
+    static constexpr bool profile = true;
+};
+
+struct GCStats
+{
+    size_t collections = 0;
+    size_t bytesFreed = 0;
+    std::chrono::nanoseconds totalPause{0};
+    std::chrono::nanoseconds maxPause{0};
+};
+
 enum InterpretResult
 {
     INTERPRET_OK,
@@ -18,40 +67,149 @@ enum InterpretResult
     INTERPRET_RUNTIME_ERROR,
 };
 
+// a module imported by the code a VM compiled, linked into it; see module.h
+struct Module
+{
+    std::string path;
+    Chunk chunk;
+    bool imported = false;  // the first import runs it, later ones do nothing
+};
+
+// An interpreter with its own heap, interned strings and globals. VMs share no mutable state, so a process can run any
+// number of them, for instance one per thread, as long as each is only used by one thread at a time.
+//
+// Embedding one takes creating it, interpret() and the globals below; destroying it releases everything it allocated.
 class VM
 {
+    friend class JitCompiler;
+    friend class ModuleLoader;
+    friend class NativeRuntime;
     friend class Obj;
     friend class ObjString;
-    friend ObjString *copyString(const char *chars, int length);
-    friend ObjString *takeString(char *chars, int length);
+    friend class Transpiler;
+    friend ObjString *copyString(VM &vm, const char *chars, int length);
+    friend void *reallocate(VM &vm, void *pointer, size_t oldSize, size_t newSize);
 
 public:
-    ~VM() { freeObjects(); }
+    VM();
+    explicit VM(const InterpretOptions &options);
+    VM(const VM &) = delete;
+    VM &operator=(const VM &) = delete;
+    ~VM();
 
     InterpretResult interpret(const std::string &source);
 
+    // the two halves of interpret(), for callers that keep compiled chunks around
+    // source must be followed by a '\0', as a std::string or a SourceFile is; the modules it imports are found
+    // relative to the directory of path, or to the working directory if there is none, and linked before this returns
+    bool compile(std::string_view source, Chunk &chunk, std::string_view path = {});
+    // may rewrite instructions of chunk to forms specialized for the types they see, see Chunk::quicken()
+    InterpretResult execute(Chunk &chunk);
+
+    // whether any code compiled so far imported a module
+    bool importsModules() const { return !modules.empty(); }
+
+    // makes the constants of a chunk roots for the collector while it is being compiled, loaded or run; scopes nest,
+    // and the chunks of all the open ones are roots, so that a module can run while the chunk importing it waits
+    class ChunkScope
+    {
+    public:
+        ChunkScope(VM &vm, const Chunk *chunk) : vm(vm), chunk(chunk), outer(vm.scopes)
+        {
+            vm.chunk = chunk;
+            vm.scopes = this;
+        }
+        ~ChunkScope()
+        {
+            vm.chunk = outer != nullptr ? outer->chunk : nullptr;
+            vm.scopes = outer;
+        }
+
+    private:
+        friend class VM;
+
+        VM &vm;
+        const Chunk *chunk;
+        ChunkScope *outer;
+    };
+
+    void setOptions(const InterpretOptions &options) { this->options = options; }
+    const InterpretOptions &getOptions() const { return options; }
+
+    Globals &getGlobals() { return globals; }
+
+    // the value of the global variable name, with a rope flattened to its string; false if it is not defined
+    bool getGlobal(std::string_view name, Value *value);
+    // defines the global variable name, or assigns it if it is already defined
+    void setGlobal(std::string_view name, Value value);
+    // a string of this VM's heap; nothing refers to it, so it must be stored, e.g. with setGlobal(), before anything
+    // else is allocated
+    Value makeString(std::string_view chars) { return OBJ_VAL(copyString(*this, chars.data(), static_cast<int>(chars.size()))); }
+
+    const GCStats &getGCStats() const { return gcStats; }
+    const Profiler &getProfiler() const { return profiler; }
+
     void resetStack() { stackTop = stack; }
     void push(Value value) { *stackTop++ = value; }
     Value pop() { return *--stackTop; }
     Value peek(int distance) { return stackTop[-1 - distance]; }
 
 private:
-    const Chunk *chunk;
-    std::vector<uint8_t>::const_iterator ip;
-    Table globals;
-    Table strings;
+    InterpretOptions options;
+    const Chunk *chunk = nullptr;  // that of the innermost scope
+    ChunkScope *scopes = nullptr;
+    const uint8_t *ip;
+    Globals globals;
+    StringTable strings;
     Obj *objects = nullptr;
 
+    // owns the memory of every object; destroying it releases them all without walking objects
+    Allocator allocator;
+    size_t bytesAllocated = 0;
+    size_t nextGC = GC_MIN_HEAP;
+    std::vector<Obj *> grayStack;
+    GCStats gcStats;
+    Profiler profiler;
+
+    // created by the first compilation
+    std::unique_ptr<ModuleLoader> moduleLoader;
+    // indexed by the operand of OP_IMPORT; a deque, so that a module stays put while it runs
+    std::deque<Module> modules;
+    const Module *runningModule = nullptr;  // nullptr while the script itself runs
+
     // std::stack can not be used here, because we need to iterate through it later
     Value stack[STACK_MAX];
     Value *stackTop = stack;
 
-    InterpretResult run();
+    // chunk is that of the innermost scope
+    template <typename Policy>
+    InterpretResult run(Chunk &chunk);
+
+    template <typename Policy>
+    InterpretResult runModule(uint32_t index);
+
+    // runs chunk, as machine code or register code if the options ask for it; name labels its lines in the profile
+    template <typename Policy>
+    InterpretResult runChunk(Chunk &chunk, std::string_view name);
+
+    // the register machine lives in register.cpp; registers are the stack slots from there up
+    template <typename Policy>
+    InterpretResult runRegisters(Value *registers);
+
+    void traceInstruction(const uint8_t *ip, const Value *stackTop);
 
     void runtimeError(const char *format, ...);
 
     void concatenate();
 
-    void freeObjects();
+    // the collector lives in memory.cpp
+    void collectGarbage();
+    void markValue(Value value);
+    void markObject(Obj *object);
+    void markRoots();
+    void traceReferences();
+    void blackenObject(Obj *object);
+    void sweep();
+    void freeObject(Obj *object);
 };
 #endif
@@ -0,0 +1,237 @@
+#!/usr/bin/env python3
+# Runs the tests against a cxxlox binary; `make test` builds the debug one and calls this.
+#
+# Every NAME.lox in this directory is a golden test. It is run in each of MODES with --no-cache, and its stdout has to
+# be NAME.out and its stderr NAME.err, each nothing if the file is missing; a test with a NAME.err has to exit with an
+# error status, any other with 0. A NAME.repl is a golden test too, whose lines are typed into the REPL, which always
+# exits with 0. Scripts in subdirectories are the modules the import tests import, never tests of their own.
+# Everything runs from the root of the repository, so the paths in error messages are relative to it.
+#
+# Then PROGRAMS random programs of globals, constant expressions and the odd type error are generated and each is run
+# in every mode, which all have to agree with the first: that catches a rewrite of the optimizer that changes a result
+# or an error without a golden file of its own. A failing program is written to WORKDIR to be rerun by hand.
+#
+# With --native, the scripts are also run as `make native` would build them: translated with --emit-cpp, compiled by the
+# command given (the compiler and its flags) and linked against the runtime objects in --native-objects. A script that
+# fails to translate gives the errors of --emit-cpp. Building takes a few seconds a script, so only the golden tests and
+# the first NATIVE_PROGRAMS random programs run natively.
+#
+# usage: run.py CXXLOX [--programs N] [--seed N] [--workdir DIR] [--native COMMAND --native-objects DIR
+#               [--native-programs N]] [NAME.lox|NAME.repl...]
+import argparse
+import concurrent.futures
+import glob
+import os
+import random
+import shlex
+import subprocess
+import sys
+import tempfile
+
+here = os.path.dirname(os.path.abspath(__file__))
+root = os.path.dirname(here)
+
+# name: arguments; the first is the reference the random programs are compared with. --jit runs the interpreter where
+# there is no code generator, which only makes that mode redundant.
+MODES = {
+    'O0': ['-O0'],
+    'O2': ['-O2'],
+    'register-vm': ['--register-vm'],
+    'jit': ['--jit'],
+}
+
+
+# runs the script at path, or the REPL with input if there is none
+def run(cxxlox, arguments, path, input=None):
+    process = subprocess.run([cxxlox, '--no-cache'] + arguments + ([path] if path else []), cwd=root, input=input, capture_output=True, text=True)
+    return process.stdout, process.stderr, process.returncode
+
+
+class Native:
+    def __init__(self, command, objects, workdir):
+        self.command = shlex.split(command)
+        # those of the runtime, which is every object of the build but the entry points of cxxlox and the microbenchmarks
+        self.objects = sorted(path for path in glob.glob(os.path.join(objects, '*.o')) if os.path.basename(path) not in ('main.o', 'microbench.o'))
+        self.workdir = workdir
+
+    # like run(), with the script built into a program of its own
+    def run(self, cxxlox, path):
+        translation = subprocess.run([cxxlox, '--no-cache', '--emit-cpp', path], cwd=root, capture_output=True, text=True)
+        if translation.returncode != 0:
+            return translation.stdout, translation.stderr, translation.returncode
+        build = tempfile.mkdtemp(prefix='native-', dir=self.workdir)
+        source = os.path.join(build, 'program.cpp')
+        program = os.path.join(build, 'program')
+        with open(source, 'w') as file:
+            file.write(translation.stdout)
+        compiled = subprocess.run(self.command + ['-I' + os.path.join(root, 'src'), source] + self.objects + ['-o', program], capture_output=True, text=True)
+        if compiled.returncode != 0:
+            return '', 'failed to build %s:\n%s' % (source, compiled.stderr), -1
+        process = subprocess.run([program], cwd=root, capture_output=True, text=True)
+        os.remove(source)
+        os.remove(program)
+        os.rmdir(build)
+        return process.stdout, process.stderr, process.returncode
+
+
+def read(path):
+    if not os.path.exists(path):
+        return None
+    with open(path) as file:
+        return file.read()
+
+
+def golden(cxxlox, test, native):
+    name, extension = os.path.splitext(test)
+    repl = extension == '.repl'
+    expected_out = read(os.path.join(here, name + '.out')) or ''
+    expected_err = read(os.path.join(here, name + '.err'))
+    results = {}
+    for mode, arguments in MODES.items():
+        if repl:
+            results[mode] = run(cxxlox, arguments, None, read(os.path.join(here, test)))
+        else:
+            results[mode] = run(cxxlox, arguments, os.path.join('test', test))
+    if native and not repl:
+        results['native'] = native.run(cxxlox, os.path.join('test', test))
+
+    failures = []
+    for mode, (out, err, status) in results.items():
+        if out != expected_out:
+            failures.append('%s [%s]: stdout\n%s\nexpected\n%s' % (name, mode, out, expected_out))
+        if err != (expected_err or ''):
+            failures.append('%s [%s]: stderr\n%s\nexpected\n%s' % (name, mode, err, expected_err or ''))
+        if (status != 0) != (expected_err is not None and not repl):
+            failures.append('%s [%s]: exit status %d' % (name, mode, status))
+    return failures
+
+
+class Generator:
+    NUMBERS = ['0', '1', '2', '3', '10', '0.5', '2.25', '100', '1000000', '0.1']
+    STRINGS = ['""', '"a"', '"bc"', '"x y"', '"0"']
+
+    def __init__(self, rng):
+        self.rng = rng
+        self.globals = {'num': ['n%d' % i for i in range(4)], 'str': ['s%d' % i for i in range(3)], 'bool': ['b%d' % i for i in range(2)]}
+        self.defined = {kind: [] for kind in self.globals}  # those an expression may read
+
+    def expression(self, kind, depth):
+        rng = self.rng
+        # once in a while an operand of the wrong type, which has to fail on the same line in every mode
+        if depth > 0 and rng.random() < 0.003:
+            kind = rng.choice(['num', 'str', 'bool', 'nil'])
+        leaf = depth == 0 or rng.random() < 0.3
+        if kind == 'nil':
+            return 'nil'
+        if kind == 'num':
+            if leaf:
+                return rng.choice(self.NUMBERS + self.defined['num'])
+            choice = rng.randrange(3)
+            if choice == 0:
+                return '-' + self.expression('num', depth - 1)
+            if choice == 1:
+                return '(%s)' % self.expression('num', depth - 1)
+            return '%s %s %s' % (self.expression('num', depth - 1), rng.choice('+-*/'), self.expression('num', depth - 1))
+        if kind == 'str':
+            if leaf:
+                return rng.choice(self.STRINGS + self.defined['str'])
+            return '%s + %s' % (self.expression('str', depth - 1), self.expression('str', depth - 1))
+        # bool
+        if leaf:
+            return rng.choice(['true', 'false'] + self.defined['bool'])
+        choice = rng.randrange(4)
+        if choice == 0:
+            return '!(%s)' % self.expression('bool', depth - 1)
+        if choice == 1:
+            return '(%s %s %s)' % (self.expression('num', depth - 1), rng.choice(['<', '<=', '>', '>=']), self.expression('num', depth - 1))
+        operand = rng.choice(['num', 'str', 'bool', 'nil'])
+        other = operand if rng.random() < 0.8 else rng.choice(['num', 'str', 'bool', 'nil'])
+        return '(%s %s %s)' % (self.expression(operand, depth - 1), rng.choice(['==', '!=']), self.expression(other, depth - 1))
+
+    def program(self, statements):
+        rng = self.rng
+        lines = []
+        for kind, names in self.globals.items():
+            for name in names:
+                lines.append('var %s = %s;' % (name, self.expression(kind, 2)))
+                self.defined[kind].append(name)
+        for _ in range(statements):
+            kind = rng.choice(list(self.globals))
+            expression = self.expression(kind, rng.randrange(5))
+            choice = rng.randrange(5)
+            if choice <= 1:
+                lines.append('print %s;' % expression)
+            elif choice == 2:
+                lines.append('%s = %s;' % (rng.choice(self.globals[kind]), expression))
+            elif choice == 3:
+                # chained assignment, then a read that may reuse the value still on the stack
+                a, b = rng.choice(self.globals[kind]), rng.choice(self.globals[kind])
+                lines.append('%s = %s = %s; print %s;' % (a, b, expression, a))
+            else:
+                lines.append('%s;' % expression)
+        lines.append('print %s;' % ' + '.join(self.globals['num']))
+        return '\n'.join(lines) + '\n'
+
+
+def differential(cxxlox, programs, seed, workdir, native, nativePrograms):
+    rng = random.Random(seed)
+    failures = []
+    for index in range(programs):
+        source = Generator(rng).program(40)
+        path = os.path.join(workdir, 'random%d.lox' % index)
+        with open(path, 'w') as file:
+            file.write(source)
+        results = {mode: run(cxxlox, arguments, path) for mode, arguments in MODES.items()}
+        if native and index < nativePrograms:
+            results['native'] = native.run(cxxlox, path)
+        reference = next(iter(MODES))
+        mismatches = [mode for mode, result in results.items() if result != results[reference]]
+        if mismatches:
+            failures.append('%s: %s differ from %s' % (path, ', '.join(mismatches), reference))
+        else:
+            os.remove(path)
+    return failures
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('cxxlox')
+    parser.add_argument('--programs', type=int, default=200)
+    parser.add_argument('--seed', type=int, default=1)
+    parser.add_argument('--workdir')
+    parser.add_argument('--native')
+    parser.add_argument('--native-objects')
+    parser.add_argument('--native-programs', type=int, default=10)
+    parser.add_argument('names', nargs='*')
+    args = parser.parse_intermixed_args()
+    cxxlox = os.path.abspath(args.cxxlox)
+    if args.native and not args.native_objects:
+        parser.error('--native needs --native-objects')
+
+    workdir = args.workdir or tempfile.mkdtemp(prefix='cxxlox-test-')
+    os.makedirs(workdir, exist_ok=True)
+    native = Native(args.native, args.native_objects, workdir) if args.native else None
+    modes = len(MODES) + (1 if native else 0)
+
+    tests = args.names or sorted(entry for entry in os.listdir(here) if entry.endswith(('.lox', '.repl')))
+    failures = []
+    # the tests are independent, and the native builds are slow enough to be worth running side by side
+    with concurrent.futures.ThreadPoolExecutor(os.cpu_count()) as executor:
+        for result in executor.map(lambda test: golden(cxxlox, test, native), tests):
+            failures += result
+    print('%d golden tests in %d modes' % (len(tests), modes))
+
+    failures += differential(cxxlox, args.programs, args.seed, workdir, native, args.native_programs)
+    print('%d random programs (seed %d) in %d modes%s' % (args.programs, args.seed, len(MODES),
+                                                        ', the first %d natively too' % min(args.programs, args.native_programs) if native else ''))
+    if not args.workdir and not os.listdir(workdir):
+        os.rmdir(workdir)
+
+    for failure in failures:
+        print('FAIL ' + failure)
+    print('%d failures' % len(failures))
+    return 1 if failures else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())